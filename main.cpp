@@ -4,6 +4,33 @@
 #include <vector>
 #include <algorithm> // For max()
 #include <sstream>   // For parsing CSV lines
+#include <iomanip>   // For setprecision (partition index)
+#include <cstdio>    // For fopen/fflush/rename (crash-safe saves)
+#include <cstdlib>   // For getenv (persistence tuning)
+#include <thread>    // Background persistence
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <map>           // Expense partition directory
+#include <unordered_map>
+#include <queue>         // Bounded heaps for top-K reports
+#include <atomic>        // Warm-up stop flag shared by shard threads
+#include <cmath>         // For llround (cold storage amounts)
+#include <cctype>        // For isdigit (date validation)
+#include <ctime>         // Current month (cold storage cutoff)
+#include <exception>     // Saving on errors / terminate
+#include <future>
+#include <csignal>       // Saving on Ctrl+C / SIGTERM
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h> // For MoveFileExA
+#include <io.h>      // For _commit
+#else
+#include <unistd.h>  // For fsync
+#include <fcntl.h>   // For open (directory sync)
+#include <pthread.h> // For pthread_sigmask
+#endif
 
 using namespace std;
 
@@ -32,9 +59,13 @@ struct Individual {
 struct Family {
     int familyID;
     string familyName;
-    vector<int> memberIDs;
+    // Members live in the memberPool of the family's shard (see GLOBAL ROOTS):
+    // memberPool[memberOffset .. memberOffset + memberCount)
+    int memberOffset;
+    int memberCount;
+    int memberCapacity; // Slots reserved at memberOffset
     double totalIncome;
-    double monthlyExpense;
+    double monthlyExpense; // Running total of everything recorded (per-month spend lives in the partitions)
 
     // Overload < operator for AVL sorting
     bool operator<(const Family& other) const {
@@ -133,27 +164,36 @@ Node<T>* leftRotate(Node<T>* x) {
     return y;
 }
 
+// --- Keys ---
+// Every record type exposes its int key, so the tree can be searched by ID
+// without constructing a dummy record
+
+int keyOf(const Individual& ind) { return ind.userID; }
+int keyOf(const Family& fam) { return fam.familyID; }
+int keyOf(const Expense& exp) { return exp.expenseID; }
+
 // --- Generic Insertion ---
+// The record is placed in its node exactly once (moved or constructed in
+// place); the recursion only passes the node pointer and the int key down.
 
+// Link an already built node into the tree
+// 'inserted' is false if the key already exists (the caller keeps newNode)
 template <typename T>
-Node<T>* insert(Node<T>* node, T data) {
+Node<T>* insertNode(Node<T>* node, Node<T>* newNode, int key, bool& inserted) {
     // 1. Normal BST insertion
     if (node == nullptr) {
-        Node<T>* newNode = new Node<T>();
-        newNode->data = data;
-        newNode->left = nullptr;
-        newNode->right = nullptr;
-        newNode->height = 1;
+        inserted = true;
         return newNode;
     }
 
-    // Overloaded operators (<, >) 
-    if (data < node->data)
-        node->left = insert(node->left, data);
-    else if (data > node->data)
-        node->right = insert(node->right, data);
-    else
+    if (key < keyOf(node->data))
+        node->left = insertNode(node->left, newNode, key, inserted);
+    else if (key > keyOf(node->data))
+        node->right = insertNode(node->right, newNode, key, inserted);
+    else {
+        inserted = false;
         return node; // No duplicates allowed
+    }
 
     // 2. Update height
     node->height = 1 + max(getHeight(node->left), getHeight(node->right));
@@ -164,21 +204,21 @@ Node<T>* insert(Node<T>* node, T data) {
     // 4. Balance the tree (4 Cases)
 
     // Left Left Case
-    if (balance > 1 && data < node->left->data)
+    if (balance > 1 && key < keyOf(node->left->data))
         return rightRotate(node);
 
     // Right Right Case
-    if (balance < -1 && data > node->right->data)
+    if (balance < -1 && key > keyOf(node->right->data))
         return leftRotate(node);
 
     // Left Right Case
-    if (balance > 1 && data > node->left->data) {
+    if (balance > 1 && key > keyOf(node->left->data)) {
         node->left = leftRotate(node->left);
         return rightRotate(node);
     }
 
     // Right Left Case
-    if (balance < -1 && data < node->right->data) {
+    if (balance < -1 && key < keyOf(node->right->data)) {
         node->right = rightRotate(node->right);
         return leftRotate(node);
     }
@@ -186,10 +226,148 @@ Node<T>* insert(Node<T>* node, T data) {
     return node;
 }
 
+// Build T in place from its fields and insert it
+// e.g. emplace(rootUsers, id, move(name), income, familyID)
+template <typename T, typename... Args>
+Node<T>* emplace(Node<T>* root, Args&&... args) {
+    Node<T>* newNode = new Node<T>{T{std::forward<Args>(args)...}, nullptr, nullptr, 1};
+    bool inserted;
+    root = insertNode(root, newNode, keyOf(newNode->data), inserted);
+    if (!inserted) delete newNode;
+    return root;
+}
+
+// Move a record into the tree ('inserted' is false if its key was already there)
+template <typename T>
+Node<T>* insert(Node<T>* root, T&& data, bool& inserted) {
+    Node<T>* newNode = new Node<T>{std::move(data), nullptr, nullptr, 1};
+    root = insertNode(root, newNode, keyOf(newNode->data), inserted);
+    if (!inserted) delete newNode;
+    return root;
+}
+
+template <typename T>
+Node<T>* insert(Node<T>* root, T&& data) {
+    bool inserted;
+    return insert(root, std::move(data), inserted);
+}
+
+// Copy a record into the tree (one copy, straight into the node)
+template <typename T>
+Node<T>* insert(Node<T>* root, const T& data) {
+    return insert(root, T(data));
+}
+
 // 3. GLOBAL ROOTS
-Node<Individual>* rootUsers = nullptr;
-Node<Family>* rootFamilies = nullptr;
-Node<Expense>* rootExpenses = nullptr;
+// The store is split into N shards by ID: families, their member slices and
+// their expenses live in shard (familyID % N), users in shard (userID % N),
+// so moving a user between families never relocates the user record.
+// Every shard has its own trees, index and files, and is loaded, saved and
+// scanned on its own thread. N comes from TRACKER_SHARDS (default: as on disk).
+
+// Expenses are partitioned by month, each month with its own AVL tree
+// The stats and the spend totals come from the index, so they are valid even
+// while the tree itself is not loaded
+struct ExpensePartition {
+    int month;          // YYYYMM
+    Node<Expense>* root;
+    bool loaded;        // Tree is in memory
+    bool dirty;         // Tree has changes that are not saved yet
+    bool compressed;    // Stored on disk as a cold block file (.blk) instead of CSV
+    bool csvOnly;       // Cold, but has rows the block format cannot hold exactly
+    int count;
+    double total;
+    int minExpenseID;
+    int maxExpenseID;
+    unordered_map<int, double> userSpend; // UserID -> spend this month
+    unordered_map<string, double> dateSpend; // Date (as written on the rows) -> spend
+    unordered_map<string, double> categorySpend; // Category -> spend
+    long long lastUsed; // For evicting the least recently used month
+};
+
+struct Shard {
+    int index;
+    string prefix; // File name prefix, "" when there is a single shard (original layout)
+
+    Node<Individual>* rootUsers;
+    Node<Family>* rootFamilies;
+
+    // Family membership for ALL of the shard's families in one flat array (CSR style)
+    // Each family owns a contiguous slice; no per-family heap allocation
+    vector<int> memberPool;
+    int memberPoolWaste; // Slots left behind by families that outgrew their slice
+
+    // Partition directory, ordered by month
+    map<int, ExpensePartition> expensePartitions;
+    long long partitionClock;
+    int archiveNext; // Oldest month the background archiver has not tried yet
+
+    mutex dataMutex; // Held while the shard's trees are modified or snapshotted
+
+    // Guarded by persistMutex
+    bool usersDirty;
+    bool familiesDirty;
+    bool expensesDirty;
+};
+
+vector<Shard*> shards;
+int lastExpenseID = 0;
+
+Shard* makeShard(int index, int count) {
+    Shard* sh = new Shard();
+    sh->index = index;
+    sh->prefix = (count == 1) ? "" : "shard" + to_string(index) + "_";
+    sh->rootUsers = nullptr;
+    sh->rootFamilies = nullptr;
+    sh->memberPoolWaste = 0;
+    sh->partitionClock = 0;
+    sh->archiveNext = 0;
+    sh->usersDirty = sh->familiesDirty = sh->expensesDirty = false;
+    return sh;
+}
+
+// --- Router ---
+Shard& shardOfUser(int userID) {
+    return *shards[(unsigned)userID % shards.size()];
+}
+
+Shard& shardOfFamily(int familyID) {
+    return *shards[(unsigned)familyID % shards.size()];
+}
+
+// Run fn on every shard, one thread per shard (inline when there is only one)
+// An exception on any shard is rethrown to the caller once all have finished
+template <typename F>
+void parallelForShards(F fn) {
+    if (shards.size() == 1) {
+        fn(*shards[0]);
+        return;
+    }
+    vector<thread> workers;
+    vector<exception_ptr> errors(shards.size());
+    for (Shard* sh : shards) {
+        workers.emplace_back([&fn, &errors, sh] {
+            try {
+                fn(*sh);
+            } catch (...) {
+                errors[sh->index] = current_exception();
+            }
+        });
+    }
+    for (thread& w : workers) w.join();
+    for (exception_ptr& e : errors) {
+        if (e) rethrow_exception(e);
+    }
+}
+
+// Locks every shard in index order, for operations that touch several of them
+// (the saver and warm-up only ever hold one shard lock, so this cannot deadlock)
+struct AllShardsLock {
+    vector<unique_lock<mutex>> locks;
+    AllShardsLock() {
+        for (Shard* sh : shards) locks.emplace_back(sh->dataMutex);
+    }
+};
 
 // 4. FILE HANDLING UTILITIES
 
@@ -204,9 +382,17 @@ vector<string> split(const string &s, char delimiter) {
     return tokens;
 }
 
+string usersFile(const Shard& sh) {
+    return sh.prefix + "users.csv";
+}
+
+string familiesFile(const Shard& sh) {
+    return sh.prefix + "families.csv";
+}
+
 // --- Load Users ---
-void loadUsers() {
-    ifstream file("users.csv");
+void loadUsers(Shard& sh) {
+    ifstream file(usersFile(sh));
     string line;
     // Format: UserID, Name, Income, FamilyID
     while (getline(file, line)) {
@@ -214,48 +400,283 @@ void loadUsers() {
         vector<string> data = split(line, ',');
         
         if (data.size() >= 4) {
-            Individual ind;
-            ind.userID = stoi(data[0]);
-            ind.name = data[1];
-            ind.income = stod(data[2]);
-            ind.familyID = stoi(data[3]);
-            
-            // Insert into AVL Tree
-            rootUsers = insert(rootUsers, ind);
+            // Build in place; the name is moved out of the parsed tokens
+            sh.rootUsers = emplace(sh.rootUsers, stoi(data[0]), std::move(data[1]),
+                                   stod(data[2]), stoi(data[3]));
         }
     }
     file.close();
-    cout << "Users loaded." << endl;
 }
 
-// --- Load Expenses ---
-void loadExpenses() {
-    ifstream file("expenses.csv");
-    string line;
-    // Format: ExpenseID, UserID, Category, Amount, Date
-    while (getline(file, line)) {
-        if (line.empty()) continue;
-        vector<string> data = split(line, ',');
-        
-        if (data.size() >= 5) {
-            Expense exp;
-            exp.expenseID = stoi(data[0]);
-            exp.userID = stoi(data[1]);
-            exp.category = data[2];
-            exp.amount = stod(data[3]);
-            exp.date = data[4];
-            
-            // Insert into AVL Tree
-            rootExpenses = insert(rootExpenses, exp);
+// --- Expense Partition Files ---
+// expense_partitions.csv : YYYY-MM, Count, Total, MinExpenseID, MaxExpenseID,
+//                          UserID:Spend;UserID:Spend;..., csv|blk (index, read at startup)
+// expenses_YYYY-MM.csv   : one month of expenses (same format as expenses.csv)
+// expenses_YYYY-MM.blk   : one cold month in the compressed block format below
+// expenses.csv           : legacy single file, imported once if no directory exists
+// With several shards every file name is prefixed with "shard<k>_".
+
+const string LEGACY_EXPENSES_FILE = "expenses.csv";
+
+// Strict DD-MM-YYYY with a day that exists in that month
+// Every date is checked with this before monthKey()/dayOf() touch it
+bool isValidDate(const string& date) {
+    if (date.size() != 10 || date[2] != '-' || date[5] != '-') return false;
+    for (int i : {0, 1, 3, 4, 6, 7, 8, 9}) {
+        if (!isdigit((unsigned char)date[i])) return false;
+    }
+
+    int day = stoi(date.substr(0, 2));
+    int month = stoi(date.substr(3, 2));
+    int year = stoi(date.substr(6, 4));
+    if (year < 1900 || month < 1 || month > 12 || day < 1) return false;
+
+    static const int daysInMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    int lastDay = daysInMonth[month - 1];
+    bool leap = (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
+    if (month == 2 && leap) lastDay = 29;
+    return day <= lastDay;
+}
+
+// Strict MM-YYYY
+bool isValidMonthInput(const string& month) {
+    return isValidDate("01-" + month);
+}
+
+// DD-MM-YYYY -> YYYYMM
+int monthKey(const string& date) {
+    return stoi(date.substr(6, 4)) * 100 + stoi(date.substr(3, 2));
+}
+
+// YYYYMM -> "YYYY-MM"
+string monthName(int month) {
+    string mm = to_string(month % 100);
+    if (mm.size() < 2) mm = "0" + mm;
+    return to_string(month / 100) + "-" + mm;
+}
+
+// "YYYY-MM" -> YYYYMM
+int parseMonthName(const string& name) {
+    return stoi(name.substr(0, 4)) * 100 + stoi(name.substr(5, 2));
+}
+
+// Number of months since year 0, so month arithmetic is plain subtraction
+int monthIndex(int month) {
+    return (month / 100) * 12 + (month % 100) - 1;
+}
+
+// Inverse of monthIndex
+int monthFromIndex(int index) {
+    return (index / 12) * 100 + (index % 12) + 1;
+}
+
+string partitionDirectoryFile(const Shard& sh) {
+    return sh.prefix + "expense_partitions.csv";
+}
+
+string partitionFile(const Shard& sh, int month) {
+    return sh.prefix + "expenses_" + monthName(month) + ".csv";
+}
+
+string coldPartitionFile(const Shard& sh, int month) {
+    return sh.prefix + "expenses_" + monthName(month) + ".blk";
+}
+
+// "DD-MM-YYYY" -> DD
+int dayOf(const string& date) {
+    return stoi(date.substr(0, 2));
+}
+
+// YYYYMM + day -> "DD-MM-YYYY"
+string dateOf(int month, int day) {
+    string mm = to_string(month % 100);
+    string dd = to_string(day);
+    if (mm.size() < 2) mm = "0" + mm;
+    if (dd.size() < 2) dd = "0" + dd;
+    return dd + "-" + mm + "-" + to_string(month / 100);
+}
+
+// --- Compressed Cold Storage ---
+// Months older than the retained window are stored as expenses_YYYY-MM.blk:
+//   "EXB1", category dictionary (count, then length + bytes each), block count,
+//   then blocks of up to COLD_BLOCK_ROWS rows sorted by date. Every block
+//   starts with a summary (row count, min/max day, sorted user IDs as deltas)
+//   and its payload size, so a scan can seek past a block it does not need.
+//   Row: ID delta (zigzag), day delta, user ID, category index, cents (zigzag).
+// All integers are LEB128 varints; amounts are kept to the cent.
+
+const string COLD_MAGIC = "EXB1";
+const size_t COLD_BLOCK_ROWS = 128;
+
+int retainMonths = 3;
+
+// Today as YYYYMM (called from the menu and the save thread: reentrant localtime)
+int currentMonth() {
+    time_t now = time(nullptr);
+    tm local;
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    return (local.tm_year + 1900) * 100 + local.tm_mon + 1;
+}
+
+// Oldest month that is always kept in memory (and in CSV); older months are cold
+// Counted back from the newest month, but never from later than today, so a
+// future-dated expense cannot push the whole history cold
+int retainCutoff(const Shard& sh) {
+    if (sh.expensePartitions.empty()) return 0;
+    int newest = min(monthIndex(sh.expensePartitions.rbegin()->first), monthIndex(currentMonth()));
+    return monthFromIndex(newest - (retainMonths - 1));
+}
+
+void putVarint(string& out, unsigned long long v) {
+    while (v >= 0x80) {
+        out += (char)((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    out += (char)v;
+}
+
+void putSigned(string& out, long long v) {
+    putVarint(out, ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63));
+}
+
+bool getVarint(istream& in, unsigned long long& v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = in.get();
+        if (c == EOF) return false;
+        v |= (unsigned long long)(c & 0x7F) << shift;
+        if ((c & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+bool getSigned(istream& in, long long& v) {
+    unsigned long long u;
+    if (!getVarint(in, u)) return false;
+    v = (long long)(u >> 1) ^ -(long long)(u & 1);
+    return true;
+}
+
+// Blocks outside [minDay, maxDay], or without any of 'users' (sorted,
+// nullptr = anyone), are skipped without reading their payload
+struct BlockFilter {
+    int minDay;
+    int maxDay;
+    const vector<int>* users;
+};
+
+bool blockHasUser(const vector<int>& blockUsers, const vector<int>* users) {
+    if (users == nullptr) return true;
+    for (int uid : blockUsers) {
+        if (binary_search(users->begin(), users->end(), uid)) return true;
+    }
+    return false;
+}
+
+// Stream the rows of a cold file to fn, block by block
+// Returns false if the file is missing, truncated or inconsistent; rows already
+// passed to fn are then only part of the month
+template <typename F>
+bool scanColdFile(const string& path, int month, const BlockFilter& filter, F fn) {
+    ifstream in(path, ios::binary);
+    if (!in.is_open()) return false;
+    in.seekg(0, ios::end);
+    long long fileSize = (long long)in.tellg();
+    in.seekg(0, ios::beg);
+
+    string magic(COLD_MAGIC.size(), '\0');
+    if (!in.read(&magic[0], magic.size()) || magic != COLD_MAGIC) return false;
+
+    // Category dictionary
+    unsigned long long count, len;
+    if (!getVarint(in, count)) return false;
+    vector<string> categories;
+    for (unsigned long long i = 0; i < count; i++) {
+        if (!getVarint(in, len) || (long long)len > fileSize - (long long)in.tellg()) return false;
+        string cat(len, '\0');
+        if (len > 0 && !in.read(&cat[0], len)) return false;
+        categories.push_back(std::move(cat));
+    }
+
+    unsigned long long blocks;
+    if (!getVarint(in, blocks)) return false;
+
+    Expense exp;
+    vector<int> blockUsers;
+    for (unsigned long long b = 0; b < blocks; b++) {
+        // Summary
+        unsigned long long rows, minDay, maxDay, userCount, delta, payloadSize;
+        if (!getVarint(in, rows) || !getVarint(in, minDay) ||
+            !getVarint(in, maxDay) || !getVarint(in, userCount)) return false;
+        if (minDay < 1 || maxDay > 31 || minDay > maxDay) return false;
+
+        blockUsers.clear();
+        int uid = 0;
+        for (unsigned long long i = 0; i < userCount; i++) {
+            if (!getVarint(in, delta)) return false;
+            uid += (int)delta;
+            blockUsers.push_back(uid);
+        }
+        if (!getVarint(in, payloadSize)) return false;
+
+        long long payloadStart = (long long)in.tellg();
+        if ((long long)payloadSize > fileSize - payloadStart) return false;
+
+        if ((int)maxDay < filter.minDay || (int)minDay > filter.maxDay ||
+            !blockHasUser(blockUsers, filter.users)) {
+            in.seekg((streamoff)payloadSize, ios::cur);
+            continue;
+        }
+
+        // Payload
+        long long id = 0, cents;
+        unsigned long long day = minDay, dayDelta, user, cat;
+        for (unsigned long long r = 0; r < rows; r++) {
+            long long idDelta;
+            if (!getSigned(in, idDelta) || !getVarint(in, dayDelta) || !getVarint(in, user) ||
+                !getVarint(in, cat) || !getSigned(in, cents) || cat >= categories.size()) return false;
+
+            id += idDelta;
+            day += dayDelta;
+            if (day > maxDay) return false;
+            exp.expenseID = (int)id;
+            exp.userID = (int)user;
+            exp.category = categories[cat];
+            exp.amount = cents / 100.0;
+            exp.date = dateOf(month, (int)day);
+            fn(exp);
         }
+        if ((long long)in.tellg() != payloadStart + (long long)payloadSize) return false;
     }
-    file.close();
-    cout << "Expenses loaded." << endl;
+    return true;
+}
+
+// Format: ExpenseID, UserID, Category, Amount, Date
+// Returns false for a line that is not a complete expense (e.g. cut off)
+bool parseExpense(const string& line, Expense& exp) {
+    if (line.empty()) return false;
+    vector<string> data = split(line, ',');
+    if (data.size() < 5) return false;
+
+    try {
+        exp.expenseID = stoi(data[0]);
+        exp.userID = stoi(data[1]);
+        exp.amount = stod(data[3]);
+    } catch (const exception&) {
+        return false;
+    }
+    exp.category = std::move(data[2]);
+    exp.date = std::move(data[4]);
+    return true;
 }
 
 // --- Load Families ---
-void loadFamilies() {
-    ifstream file("families.csv");
+void loadFamilies(Shard& sh) {
+    ifstream file(familiesFile(sh));
     string line;
     // Format: FamilyID, FamilyName, MemberIDs(1;2;3), TotalIncome, MonthlyExpense
     while (getline(file, line)) {
@@ -265,175 +686,1423 @@ void loadFamilies() {
         if (data.size() >= 5) {
             Family fam;
             fam.familyID = stoi(data[0]);
-            fam.familyName = data[1];
             
-            // Parse Member IDs (separated by semicolon)
-            vector<string> members = split(data[2], ';');
-            for (const string& m : members) {
-                if(!m.empty()) fam.memberIDs.push_back(stoi(m));
+            // Parse Member IDs (separated by semicolon) straight into the pool
+            fam.memberOffset = (int)sh.memberPool.size();
+            istringstream members(data[2]);
+            string m;
+            while (getline(members, m, ';')) {
+                if(!m.empty()) sh.memberPool.push_back(stoi(m));
             }
+            fam.memberCount = (int)sh.memberPool.size() - fam.memberOffset;
+            fam.memberCapacity = fam.memberCount;
             
+            fam.familyName = std::move(data[1]);
             fam.totalIncome = stod(data[3]);
             fam.monthlyExpense = stod(data[4]);
             
             // Insert into AVL Tree
-            rootFamilies = insert(rootFamilies, fam);
+            sh.rootFamilies = insert(sh.rootFamilies, std::move(fam));
+        }
+    }
+    file.close();
+}
+
+
+// 5. SAVE DATA UTILITIES
+
+// --- Crash-Safe Commit ---
+// Saves never truncate the live CSVs. Each table is written to "<file>.gen<N>"
+// and fsync'd first, then the manifest is atomically replaced to mark
+// generation N as committed, and only after that are the files renamed over
+// the live ones. A crash before the manifest switch leaves the old generation
+// untouched; a crash after it is rolled forward by recoverPendingSave().
+
+const string MANIFEST_FILE = "tracker.manifest";
+long long saveGeneration = 0; // Last committed generation
+vector<string> unpublishedFiles; // Generation files a failed rename left behind
+
+string generationPath(const string& path, long long gen) {
+    return path + ".gen" + to_string(gen);
+}
+
+// Write content to path and force it to disk before returning
+bool writeDurable(const string& path, const string& content) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (f == nullptr) return false;
+
+    bool ok = fwrite(content.data(), 1, content.size(), f) == content.size();
+    ok = (fflush(f) == 0) && ok;
+#ifdef _WIN32
+    ok = (_commit(_fileno(f)) == 0) && ok;
+#else
+    ok = (fsync(fileno(f)) == 0) && ok;
+#endif
+    ok = (fclose(f) == 0) && ok;
+    return ok;
+}
+
+// Atomically replace 'to' with 'from'
+bool replaceFile(const string& from, const string& to) {
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(),
+                       MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+// Make the renames themselves durable (POSIX only, Windows uses WRITE_THROUGH)
+void syncDirectory() {
+#ifndef _WIN32
+    int fd = open(".", O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+}
+
+bool fileExists(const string& path) {
+    ifstream f(path);
+    return f.good();
+}
+
+// Commit a set of (file, content) tables as ONE generation
+// Either all of them become visible or none of them do
+// Returns false if anything failed; the tables must then be committed again
+bool commitTables(const vector<pair<string, string>>& tables) {
+    long long gen = saveGeneration + 1;
+
+    // 1. Write every table of the new generation next to the live file
+    for (const auto& t : tables) {
+        if (!writeDurable(generationPath(t.first, gen), t.second)) {
+            cout << "Error writing " << t.first << "! Previous data kept." << endl;
+            return false;
+        }
+    }
+
+    // 2. Commit point: switch the manifest to the new generation
+    // Format: generation,N followed by one table file name per line
+    string manifest = "generation," + to_string(gen) + "\n";
+    for (const auto& t : tables) manifest += t.first + "\n";
+
+    string manifestTmp = MANIFEST_FILE + ".tmp";
+    if (!writeDurable(manifestTmp, manifest) || !replaceFile(manifestTmp, MANIFEST_FILE)) {
+        cout << "Error writing " << MANIFEST_FILE << "! Previous data kept." << endl;
+        return false;
+    }
+    syncDirectory();
+    saveGeneration = gen;
+
+    // 3. Publish: move the new generation over the live files
+    // (if we die half way, recoverPendingSave() finishes this on next start)
+    // A rename can fail while the live file is open (Windows). The generation
+    // is committed, but the live file is stale, so report failure: the caller
+    // keeps the tables dirty and they are written again in the next generation
+    bool published = true;
+    for (const auto& t : tables) {
+        string pending = generationPath(t.first, gen);
+        if (!replaceFile(pending, t.first)) {
+            cout << "Error replacing " << t.first << "! It will be saved again." << endl;
+            unpublishedFiles.push_back(pending);
+            published = false;
+        }
+    }
+    syncDirectory();
+    if (!published) return false;
+
+    // Everything left behind earlier has now been rewritten and published
+    for (const string& path : unpublishedFiles) remove(path.c_str());
+    unpublishedFiles.clear();
+    return true;
+}
+
+// Called once at startup, before any load
+// Rolls forward a committed generation whose renames did not all complete
+void recoverPendingSave() {
+    ifstream file(MANIFEST_FILE);
+    if (!file.is_open()) return;
+
+    string line;
+    if (!getline(file, line)) return;
+    vector<string> header = split(line, ',');
+    if (header.size() < 2 || header[0] != "generation") return;
+    saveGeneration = stoll(header[1]);
+
+    bool recovered = false;
+    while (getline(file, line)) {
+        if (line.empty()) continue;
+        string pending = generationPath(line, saveGeneration);
+        if (fileExists(pending) && replaceFile(pending, line)) recovered = true;
+    }
+    file.close();
+
+    if (recovered) {
+        syncDirectory();
+        cout << "Recovered interrupted save (generation " << saveGeneration << ")." << endl;
+    }
+}
+
+// Save Users Recursively
+void saveUserNode(Node<Individual>* root, ostream& file) {
+    if (root == nullptr) return;
+    
+    // 1. Go Left
+    saveUserNode(root->left, file);
+    
+    // 2. Write Data
+    file << root->data.userID << ","
+         << root->data.name << ","
+         << root->data.income << ","
+         << root->data.familyID << "\n";
+         
+    // 3. Go Right
+    saveUserNode(root->right, file);
+}
+
+string serializeUsers(const Shard& sh) {
+    ostringstream out;
+    saveUserNode(sh.rootUsers, out);
+    return out.str();
+}
+
+// Save Families Recursively 
+void saveFamilyNode(Node<Family>* root, const vector<int>& memberPool, ostream& file) {
+    if (root == nullptr) return;
+    
+    saveFamilyNode(root->left, memberPool, file);
+    
+    // Write Data
+    file << root->data.familyID << ","
+         << root->data.familyName << ",";
+         
+    // Join MemberIDs with ';'
+    for (int i = 0; i < root->data.memberCount; i++) {
+        file << memberPool[root->data.memberOffset + i];
+        if (i != root->data.memberCount - 1) file << ";";
+    }
+    
+    file << "," << root->data.totalIncome << ","
+         << root->data.monthlyExpense << "\n";
+         
+    saveFamilyNode(root->right, memberPool, file);
+}
+
+string serializeFamilies(const Shard& sh) {
+    ostringstream out;
+    saveFamilyNode(sh.rootFamilies, sh.memberPool, out);
+    return out.str();
+}
+
+// Save Expenses Recursively 
+void saveExpenseNode(Node<Expense>* root, ostream& file) {
+    if (root == nullptr) return;
+    
+    saveExpenseNode(root->left, file);
+    
+    // Write Data
+    file << root->data.expenseID << ","
+         << root->data.userID << ","
+         << root->data.category << ","
+         << root->data.amount << ","
+         << root->data.date << "\n";
+         
+    saveExpenseNode(root->right, file);
+}
+
+string serializePartition(const ExpensePartition& part) {
+    ostringstream out;
+    saveExpenseNode(part.root, out);
+    return out.str();
+}
+
+// Collect Expenses In Order (by ID)
+void collectExpenseNodes(Node<Expense>* root, vector<const Expense*>& rows) {
+    if (root == nullptr) return;
+    collectExpenseNodes(root->left, rows);
+    rows.push_back(&root->data);
+    collectExpenseNodes(root->right, rows);
+}
+
+// Can the block format store this row exactly? Dates are rebuilt from the
+// month and day and amounts are whole cents, so anything else stays in CSV
+bool coldEncodable(const Expense& e, int month) {
+    if (!isValidDate(e.date) || monthKey(e.date) != month) return false;
+    if (e.date != dateOf(month, dayOf(e.date))) return false;
+    return llround(e.amount * 100) / 100.0 == e.amount;
+}
+
+// Same, for every row of a loaded month
+bool partitionEncodable(const ExpensePartition& part) {
+    vector<const Expense*> rows;
+    collectExpenseNodes(part.root, rows);
+    for (const Expense* e : rows) {
+        if (!coldEncodable(*e, part.month)) return false;
+    }
+    return true;
+}
+
+// Encode a month in the cold block format (see Compressed Cold Storage)
+// Returns false, writing nothing, if a row cannot be stored exactly
+bool serializeColdPartition(const ExpensePartition& part, string& out) {
+    if (!partitionEncodable(part)) return false;
+
+    vector<const Expense*> rows;
+    collectExpenseNodes(part.root, rows);
+
+    // Date order keeps every block's day range tight (IDs stay ordered within a day)
+    stable_sort(rows.begin(), rows.end(), [](const Expense* a, const Expense* b) {
+        return dayOf(a->date) < dayOf(b->date);
+    });
+
+    // Category dictionary
+    vector<string> categories;
+    unordered_map<string, int> categoryCode;
+    for (const Expense* e : rows) {
+        if (categoryCode.emplace(e->category, (int)categories.size()).second) {
+            categories.push_back(e->category);
+        }
+    }
+
+    out = COLD_MAGIC;
+    putVarint(out, categories.size());
+    for (const string& cat : categories) {
+        putVarint(out, cat.size());
+        out += cat;
+    }
+
+    putVarint(out, (rows.size() + COLD_BLOCK_ROWS - 1) / COLD_BLOCK_ROWS);
+    for (size_t begin = 0; begin < rows.size(); begin += COLD_BLOCK_ROWS) {
+        size_t end = min(rows.size(), begin + COLD_BLOCK_ROWS);
+        int minDay = dayOf(rows[begin]->date);
+
+        // Payload
+        string payload;
+        vector<int> users;
+        long long prevID = 0;
+        int prevDay = minDay;
+        for (size_t i = begin; i < end; i++) {
+            const Expense& e = *rows[i];
+            int day = dayOf(e.date);
+            putSigned(payload, e.expenseID - prevID);
+            putVarint(payload, day - prevDay);
+            putVarint(payload, e.userID);
+            putVarint(payload, categoryCode[e.category]);
+            putSigned(payload, llround(e.amount * 100));
+            prevID = e.expenseID;
+            prevDay = day;
+            users.push_back(e.userID);
+        }
+        sort(users.begin(), users.end());
+        users.erase(unique(users.begin(), users.end()), users.end());
+
+        // Summary
+        putVarint(out, end - begin);
+        putVarint(out, minDay);
+        putVarint(out, prevDay); // Rows are date ordered, so the last day is the max
+        putVarint(out, users.size());
+        int prevUser = 0;
+        for (int uid : users) {
+            putVarint(out, uid - prevUser);
+            prevUser = uid;
+        }
+        putVarint(out, payload.size());
+        out += payload;
+    }
+    return true;
+}
+
+// Dates and categories are free text: keep the index separators out of them
+string escapeIndexKey(const string& key) {
+    string out;
+    for (char c : key) {
+        if (c == '%' || c == ',' || c == ';' || c == ':') {
+            const char* hex = "0123456789ABCDEF";
+            out += '%';
+            out += hex[(unsigned char)c >> 4];
+            out += hex[c & 0xF];
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+string unescapeIndexKey(const string& key) {
+    string out;
+    for (size_t i = 0; i < key.size(); i++) {
+        if (key[i] == '%' && i + 2 < key.size() &&
+            isxdigit((unsigned char)key[i + 1]) && isxdigit((unsigned char)key[i + 2])) {
+            out += (char)stoi(key.substr(i + 1, 2), nullptr, 16);
+            i += 2;
+        } else {
+            out += key[i];
+        }
+    }
+    return out;
+}
+
+// Key:Spend;Key:Spend;... (caller sets the precision)
+void writeTextSpend(ostream& out, const unordered_map<string, double>& spend) {
+    bool first = true;
+    for (const auto& ks : spend) {
+        if (!first) out << ";";
+        out << escapeIndexKey(ks.first) << ":" << ks.second;
+        first = false;
+    }
+}
+
+void readTextSpend(const string& field, unordered_map<string, double>& spend) {
+    for (const string& ks : split(field, ';')) {
+        size_t colon = ks.find(':');
+        if (colon == string::npos) continue;
+        spend[unescapeIndexKey(ks.substr(0, colon))] += stod(ks.substr(colon + 1));
+    }
+}
+
+string serializePartitionDirectory(const Shard& sh) {
+    ostringstream out;
+    out << fixed << setprecision(2);
+    for (const auto& entry : sh.expensePartitions) {
+        const ExpensePartition& part = entry.second;
+        out << monthName(part.month) << ","
+            << part.count << ","
+            << part.total << ","
+            << part.minExpenseID << ","
+            << part.maxExpenseID << ",";
+
+        bool first = true;
+        for (const auto& us : part.userSpend) {
+            if (!first) out << ";";
+            out << us.first << ":" << us.second;
+            first = false;
+        }
+        out << "," << (part.compressed ? "blk" : "csv") << ",";
+        writeTextSpend(out, part.dateSpend);
+        out << ",";
+        writeTextSpend(out, part.categorySpend);
+        out << "\n";
+    }
+    return out.str();
+}
+
+// --- Background Persistence ---
+// Mutations only mark their shard's tables dirty; a background thread coalesces
+// bursts and commits the dirty tables every flushIntervalMs, or sooner once
+// flushThreshold mutations have piled up. Override with the environment
+// variables TRACKER_FLUSH_MS and TRACKER_FLUSH_THRESHOLD.
+// Shards are snapshotted in parallel but committed as ONE generation, so a
+// change spanning shards (a user joining a family elsewhere) is still atomic.
+
+const string SHARD_LAYOUT_FILE = "shards.csv"; // Shard count the files were written with
+
+mutex persistMutex;  // Guards the dirty flags and counters below (and in each Shard)
+mutex commitMutex;   // Only one generation is committed at a time
+condition_variable persistCV;
+
+bool layoutDirty = false;
+int pendingMutations = 0;
+bool persistStop = false;
+thread persistThread;
+
+int flushIntervalMs = 2000;
+int flushThreshold = 50;
+
+// Record that a shard's tables changed (cheap, called on the menu thread)
+void markDirty(Shard& sh, bool users, bool families, bool expenses) {
+    bool wake;
+    {
+        lock_guard<mutex> lock(persistMutex);
+        sh.usersDirty = sh.usersDirty || users;
+        sh.familiesDirty = sh.familiesDirty || families;
+        sh.expensesDirty = sh.expensesDirty || expenses;
+        pendingMutations++;
+        wake = (pendingMutations >= flushThreshold);
+    }
+    if (wake) persistCV.notify_one();
+}
+
+// What one shard has to write in a flush
+struct ShardFlush {
+    bool users;
+    bool families;
+    bool expenses;
+    vector<pair<string, string>> tables;
+    vector<pair<int, bool>> savedMonths; // Month, was it compressed before
+    vector<string> staleFiles; // Old-format files of months that switched format
+};
+
+// Commit every dirty table of every shard as one generation
+// Returns false (and keeps the tables dirty) if the write failed
+bool flushDirty() {
+    lock_guard<mutex> commitLock(commitMutex);
+
+    vector<ShardFlush> work(shards.size());
+    bool layout;
+    bool any = false;
+    {
+        lock_guard<mutex> lock(persistMutex);
+        for (Shard* sh : shards) {
+            ShardFlush& w = work[sh->index];
+            w.users = sh->usersDirty;
+            w.families = sh->familiesDirty;
+            w.expenses = sh->expensesDirty;
+            sh->usersDirty = sh->familiesDirty = sh->expensesDirty = false;
+            any = any || w.users || w.families || w.expenses;
+        }
+        layout = layoutDirty;
+        layoutDirty = false;
+        pendingMutations = 0;
+    }
+    if (!any && !layout) return true;
+
+    // Snapshot each shard under its own lock (in parallel), write without locks
+    // Only the months that changed are rewritten, plus the shard's directory;
+    // months before the retained window are written in the cold block format
+    parallelForShards([&work](Shard& sh) {
+        ShardFlush& w = work[sh.index];
+        if (!w.users && !w.families && !w.expenses) return;
+
+        lock_guard<mutex> lock(sh.dataMutex);
+        if (w.users) w.tables.push_back({usersFile(sh), serializeUsers(sh)});
+        if (w.families) w.tables.push_back({familiesFile(sh), serializeFamilies(sh)});
+        if (w.expenses) {
+            int cutoff = retainCutoff(sh);
+            for (auto& entry : sh.expensePartitions) {
+                ExpensePartition& part = entry.second;
+                if (!part.dirty) continue;
+
+                // Months with rows the block format cannot hold exactly stay in CSV
+                string encoded;
+                bool cold = part.month < cutoff && serializeColdPartition(part, encoded);
+                if (cold) {
+                    w.tables.push_back({coldPartitionFile(sh, part.month), std::move(encoded)});
+                } else {
+                    w.tables.push_back({partitionFile(sh, part.month), serializePartition(part)});
+                }
+                if (cold != part.compressed) {
+                    w.staleFiles.push_back(cold ? partitionFile(sh, part.month)
+                                                : coldPartitionFile(sh, part.month));
+                }
+                w.savedMonths.push_back({part.month, part.compressed});
+                part.compressed = cold;
+                part.csvOnly = part.month < cutoff && !cold;
+                part.dirty = false;
+            }
+            w.tables.push_back({partitionDirectoryFile(sh), serializePartitionDirectory(sh)});
+        }
+    });
+
+    vector<pair<string, string>> tables;
+    for (ShardFlush& w : work) {
+        for (auto& t : w.tables) tables.push_back(std::move(t));
+    }
+    if (layout) tables.push_back({SHARD_LAYOUT_FILE, to_string(shards.size()) + "\n"});
+
+    if (!commitTables(tables)) {
+        for (Shard* sh : shards) {
+            lock_guard<mutex> lock(sh->dataMutex);
+            // Still dirty, and still in the format that is on disk
+            for (const auto& saved : work[sh->index].savedMonths) {
+                ExpensePartition& part = sh->expensePartitions[saved.first];
+                part.dirty = true;
+                part.compressed = saved.second;
+            }
+        }
+        lock_guard<mutex> lock(persistMutex);
+        for (Shard* sh : shards) {
+            const ShardFlush& w = work[sh->index];
+            sh->usersDirty = sh->usersDirty || w.users;
+            sh->familiesDirty = sh->familiesDirty || w.families;
+            sh->expensesDirty = sh->expensesDirty || w.expenses;
+        }
+        layoutDirty = layoutDirty || layout;
+        pendingMutations++;
+        return false;
+    }
+
+    // The index no longer points at these; a crash before this only leaves litter
+    for (const ShardFlush& w : work) {
+        for (const string& path : w.staleFiles) remove(path.c_str());
+    }
+    return true;
+}
+
+void archiveColdMonths();
+
+void persistenceWorker() {
+    unique_lock<mutex> lock(persistMutex);
+    while (!persistStop) {
+        persistCV.wait_for(lock, chrono::milliseconds(flushIntervalMs), [] {
+            return persistStop || pendingMutations >= flushThreshold;
+        });
+        if (persistStop) continue;
+        if (pendingMutations == 0) {
+            // Nothing to save: use the quiet spell to convert old history
+            lock.unlock();
+            archiveColdMonths();
+            lock.lock();
+            continue;
+        }
+
+        lock.unlock();
+        bool saved = flushDirty();
+        lock.lock();
+
+        // After a failed write wait a full interval before retrying, however
+        // many changes are pending, instead of spinning on a broken disk
+        if (!saved) {
+            persistCV.wait_for(lock, chrono::milliseconds(flushIntervalMs), [] {
+                return persistStop;
+            });
+        }
+    }
+}
+
+void startPersistence() {
+    if (const char* ms = getenv("TRACKER_FLUSH_MS")) flushIntervalMs = max(1, atoi(ms));
+    if (const char* n = getenv("TRACKER_FLUSH_THRESHOLD")) flushThreshold = max(1, atoi(n));
+    persistThread = thread(persistenceWorker);
+}
+
+// Stop the saver and synchronously flush whatever is still dirty
+bool stopPersistence() {
+    {
+        lock_guard<mutex> lock(persistMutex);
+        persistStop = true;
+    }
+    persistCV.notify_one();
+    if (persistThread.joinable()) persistThread.join();
+    return flushDirty();
+}
+
+// 6. CORE LOGIC & HELPERS
+
+// Find Maximum ID in Tree (Right-most node)
+template <typename T>
+int getMaxID(Node<T>* root) {
+    if (root == nullptr) return 0;
+    while (root->right != nullptr) {
+        root = root->right;
+    }
+    return keyOf(root->data);
+}
+
+int getMaxUserID(Node<Individual>* root) {
+    return getMaxID(root);
+}
+
+int getMaxFamilyID(Node<Family>* root) {
+    return getMaxID(root);
+}
+
+// Next free IDs are global across shards
+int nextUserID() {
+    int maxID = 0;
+    for (Shard* sh : shards) maxID = max(maxID, getMaxUserID(sh->rootUsers));
+    return maxID + 1;
+}
+
+int nextFamilyID() {
+    int maxID = 0;
+    for (Shard* sh : shards) maxID = max(maxID, getMaxFamilyID(sh->rootFamilies));
+    return maxID + 1;
+}
+
+// Search Function 
+// Returns pointer to Node if found, nullptr otherwise
+// Compares the int key directly, no T is constructed
+template <typename T>
+Node<T>* search(Node<T>* root, int id) {
+    while (root != nullptr) {
+        int key = keyOf(root->data);
+        if (id == key) return root;
+        root = (id < key) ? root->left : root->right;
+    }
+    return nullptr;
+}
+
+Node<Individual>* searchUser(Node<Individual>* root, int id) {
+    return search(root, id);
+}
+
+Node<Family>* searchFamily(Node<Family>* root, int id) {
+    return search(root, id);
+}
+
+// Routed lookups: go straight to the owning shard's tree
+Node<Individual>* findUser(int id) {
+    return searchUser(shardOfUser(id).rootUsers, id);
+}
+
+Node<Family>* findFamily(int id) {
+    return searchFamily(shardOfFamily(id).rootFamilies, id);
+}
+
+// Free a whole tree (used when a month is evicted from memory)
+template <typename T>
+void freeTree(Node<T>* root) {
+    if (root == nullptr) return;
+    freeTree(root->left);
+    freeTree(root->right);
+    delete root;
+}
+
+// Hand every record to fn (moved out) and free the tree (used when resharding)
+template <typename T, typename F>
+void drainTree(Node<T>* root, F fn) {
+    if (root == nullptr) return;
+    drainTree(root->left, fn);
+    drainTree(root->right, fn);
+    fn(std::move(root->data));
+    delete root;
+}
+
+// --- Expense Partitions ---
+// Startup reads only each shard's index (expense_partitions.csv), never an
+// expense file, so time-to-prompt does not depend on ledger size. A month's
+// tree is read from its own file the first time a query touches it; family
+// and user queries use the index's per-user spend to skip months they have no
+// rows in. Clean months older than the newest retainMonths are evicted (LRU)
+// once more than maxLoadedMonths of a shard are in memory. Setting
+// TRACKER_WARMUP=1 pre-loads the newest months of every shard in the background.
+// Override with TRACKER_RETAIN_MONTHS / TRACKER_MAX_LOADED_MONTHS.
+
+int maxLoadedMonths = 12;
+
+vector<thread> warmUpThreads;
+atomic<bool> warmUpStop(false);
+
+// Move an expense into a loaded partition and update its stats
+// Returns false, leaving the stats alone, if the month already has that expense ID
+bool addToPartition(ExpensePartition& part, Expense&& exp) {
+    int id = exp.expenseID;
+    int userID = exp.userID;
+    double amount = exp.amount;
+    string date = exp.date;
+    string category = exp.category;
+    bool inserted;
+    part.root = insert(part.root, std::move(exp), inserted);
+    if (!inserted) return false;
+
+    part.count++;
+    part.total += amount;
+    if (part.count == 1 || id < part.minExpenseID) part.minExpenseID = id;
+    if (id > part.maxExpenseID) part.maxExpenseID = id;
+    part.userSpend[userID] += amount;
+    part.dateSpend[date] += amount;
+    part.categorySpend[category] += amount;
+    return true;
+}
+
+ExpensePartition makePartition(int month) {
+    ExpensePartition part;
+    part.month = month;
+    part.root = nullptr;
+    part.loaded = true;
+    part.dirty = false;
+    part.compressed = false;
+    part.csvOnly = false;
+    part.count = 0;
+    part.total = 0;
+    part.minExpenseID = 0;
+    part.maxExpenseID = 0;
+    part.lastUsed = 0;
+    return part;
+}
+
+// Find the month's partition in a shard, creating an empty one if it does not exist
+ExpensePartition& partitionFor(Shard& sh, int month) {
+    auto it = sh.expensePartitions.find(month);
+    if (it != sh.expensePartitions.end()) return it->second;
+
+    lock_guard<mutex> lock(sh.dataMutex);
+    return sh.expensePartitions.emplace(month, makePartition(month)).first->second;
+}
+
+// Read a partition's tree from its file (caller holds the shard's dataMutex)
+// Only the tree is kept: the stats already come from the index, and other
+// threads may be reading them. rebuildStats replaces them with the file's.
+// Returns false, leaving the month unloaded and untouched, if the file is
+// missing or damaged or its row count does not match the index: the month
+// must never be mistaken for (and later saved as) a shorter one.
+bool loadPartitionLocked(Shard& sh, ExpensePartition& part, bool rebuildStats) {
+    if (part.loaded) return true;
+
+    // Rows go into a scratch partition until the whole file has been read
+    ExpensePartition fresh = makePartition(part.month);
+    string path = part.compressed ? coldPartitionFile(sh, part.month) : partitionFile(sh, part.month);
+    bool ok;
+    int duplicates = 0;
+    if (part.compressed) {
+        BlockFilter all = {1, 31, nullptr};
+        ok = scanColdFile(path, part.month, all, [&fresh, &duplicates](Expense& exp) {
+            if (!addToPartition(fresh, std::move(exp))) duplicates++;
+        });
+    } else {
+        ifstream file(path);
+        ok = file.is_open();
+        string line;
+        Expense exp;
+        while (ok && getline(file, line)) {
+            if (line.empty()) continue;
+            if (!parseExpense(line, exp)) ok = false;
+            else if (!addToPartition(fresh, std::move(exp))) duplicates++;
+        }
+    }
+    if (ok && duplicates > 0) {
+        cout << "\nWarning: skipped " << duplicates << " rows of " << path
+             << " that repeat an expense ID." << endl;
+    }
+    if (ok && !rebuildStats && fresh.count != part.count) ok = false;
+
+    if (!ok) {
+        freeTree(fresh.root);
+        cout << "\nError: " << path << " is missing or damaged; "
+             << monthName(part.month) << " is left as it is on disk." << endl;
+        return false;
+    }
+
+    if (rebuildStats) {
+        part.count = fresh.count;
+        part.total = fresh.total;
+        part.minExpenseID = fresh.minExpenseID;
+        part.maxExpenseID = fresh.maxExpenseID;
+        part.userSpend.swap(fresh.userSpend);
+        part.dateSpend.swap(fresh.dateSpend);
+        part.categorySpend.swap(fresh.categorySpend);
+    }
+    part.root = fresh.root;
+    part.loaded = true;
+    return true;
+}
+
+// Fault a partition's tree in if needed (false if its file could not be read)
+bool ensureLoaded(Shard& sh, ExpensePartition& part) {
+    lock_guard<mutex> lock(sh.dataMutex);
+    part.lastUsed = ++sh.partitionClock;
+    return loadPartitionLocked(sh, part, false);
+}
+
+// Visit every expense of a month in ID order (loaded tree)
+template <typename F>
+void visitExpenses(Node<Expense>* root, F& fn) {
+    if (root == nullptr) return;
+    visitExpenses(root->left, fn);
+    fn(root->data);
+    visitExpenses(root->right, fn);
+}
+
+// Visit a month's expenses that may pass the filter (fn still checks each row)
+// A cold month that is not in memory is streamed from its block file, skipping
+// blocks whose summary cannot match, and is NOT loaded; anything else is
+// faulted in and its tree walked
+// Returns false (after a warning) if the month's file could not be read
+template <typename F>
+bool scanPartition(Shard& sh, ExpensePartition& part, const BlockFilter& filter, F fn) {
+    bool streamed;
+    {
+        lock_guard<mutex> lock(sh.dataMutex);
+        streamed = !part.loaded && part.compressed;
+        if (!streamed) {
+            part.lastUsed = ++sh.partitionClock;
+            if (!loadPartitionLocked(sh, part, false)) return false;
+        }
+    }
+    if (!streamed) {
+        visitExpenses(part.root, fn);
+        return true;
+    }
+
+    string path = coldPartitionFile(sh, part.month);
+    if (scanColdFile(path, part.month, filter, fn)) return true;
+    cout << "\nWarning: " << path << " is missing or damaged; results for "
+         << monthName(part.month) << " may be incomplete." << endl;
+    return false;
+}
+
+// What a family spent in one shard's month, from its CURRENT members (no tree needed)
+double familySpendIn(const ExpensePartition& part, int familyID, bool& anyRows) {
+    double spend = 0;
+    anyRows = false;
+    Node<Family>* fNode = findFamily(familyID);
+    if (fNode == nullptr) return 0;
+
+    const vector<int>& pool = shardOfFamily(familyID).memberPool;
+    for (int i = 0; i < fNode->data.memberCount; i++) {
+        auto it = part.userSpend.find(pool[fNode->data.memberOffset + i]);
+        if (it != part.userSpend.end()) {
+            spend += it->second;
+            anyRows = true;
+        }
+    }
+    return spend;
+}
+
+// What a family spent in a month across all shards
+// (members who moved in from another family may have rows in other shards)
+double familyMonthSpend(int familyID, int month) {
+    double spend = 0;
+    for (Shard* sh : shards) {
+        auto it = sh->expensePartitions.find(month);
+        if (it == sh->expensePartitions.end()) continue;
+        bool anyRows;
+        spend += familySpendIn(it->second, familyID, anyRows);
+    }
+    return spend;
+}
+
+// One shard's partitions (not loaded) in which one of the family's members spent something
+// Most of a family's rows are in its own shard, but members who moved in keep
+// theirs where they were added, so family reports ask every shard in parallel
+vector<ExpensePartition*> familyPartitions(Shard& sh, int familyID) {
+    vector<ExpensePartition*> parts;
+    for (auto& entry : sh.expensePartitions) {
+        bool anyRows;
+        familySpendIn(entry.second, familyID, anyRows);
+        if (anyRows) parts.push_back(&entry.second);
+    }
+    return parts;
+}
+
+// Same, loaded
+vector<ExpensePartition*> partitionsForFamily(Shard& sh, int familyID) {
+    vector<ExpensePartition*> parts;
+    for (ExpensePartition* part : familyPartitions(sh, familyID)) {
+        if (ensureLoaded(sh, *part)) parts.push_back(part);
+    }
+    return parts;
+}
+
+// Current members of a family, sorted (for block filters)
+vector<int> familyMembers(int familyID) {
+    vector<int> members;
+    Node<Family>* fNode = findFamily(familyID);
+    if (fNode == nullptr) return members;
+
+    const vector<int>& pool = shardOfFamily(familyID).memberPool;
+    members.assign(pool.begin() + fNode->data.memberOffset,
+                   pool.begin() + fNode->data.memberOffset + fNode->data.memberCount);
+    sort(members.begin(), members.end());
+    return members;
+}
+
+// Loaded partitions (any shard) in which the user spent something
+vector<ExpensePartition*> partitionsForUser(int userID) {
+    vector<ExpensePartition*> parts;
+    for (Shard* sh : shards) {
+        for (auto& entry : sh->expensePartitions) {
+            if (entry.second.userSpend.count(userID) == 0) continue;
+            if (ensureLoaded(*sh, entry.second)) parts.push_back(&entry.second);
+        }
+    }
+    return parts;
+}
+
+// Drop clean, old, least recently used months until the shard is under the limit
+// A cold month still stored as CSV is archived (re-saved as a block file) on its
+// way out instead, and evicted on a later pass; one the codec cannot store
+// exactly is already current on disk and is evicted as CSV
+// Called between menu actions, never while a report holds partition pointers
+void evictColdPartitions(Shard& sh) {
+    // Months snapshotted by a commit still in flight look clean, but must stay
+    // in memory in case that commit fails; skip this pass rather than wait
+    unique_lock<mutex> commitLock(commitMutex, try_to_lock);
+    if (!commitLock.owns_lock()) return;
+
+    int cutoff = retainCutoff(sh);
+    bool archived = false;
+    {
+        lock_guard<mutex> lock(sh.dataMutex);
+
+        int loadedCount = 0;
+        for (const auto& entry : sh.expensePartitions) {
+            if (entry.second.loaded) loadedCount++;
+        }
+
+        while (loadedCount > maxLoadedMonths) {
+            ExpensePartition* victim = nullptr;
+            for (auto& entry : sh.expensePartitions) {
+                ExpensePartition& part = entry.second;
+                if (!part.loaded || part.dirty || part.month >= cutoff) continue;
+                if (victim == nullptr || part.lastUsed < victim->lastUsed) victim = &part;
+            }
+            if (victim == nullptr) break;
+
+            if (!victim->compressed && !victim->csvOnly) {
+                if (partitionEncodable(*victim)) {
+                    victim->dirty = true;
+                    archived = true;
+                    continue;
+                }
+                victim->csvOnly = true;
+            }
+
+            // Stats and userSpend stay: they are the index
+            freeTree(victim->root);
+            victim->root = nullptr;
+            victim->loaded = false;
+            loadedCount--;
+        }
+    }
+    if (archived) markDirty(sh, false, false, true);
+}
+
+// Idle work for the persistence thread: convert the oldest unconverted cold CSV
+// month of each shard to the block format, then drop its tree again
+// A month that was used or changed meanwhile stays loaded for the evictor
+void archiveColdMonths() {
+    vector<pair<ExpensePartition*, long long>> picked(shards.size(), {nullptr, 0});
+    bool any = false;
+    for (Shard* sh : shards) {
+        lock_guard<mutex> lock(sh->dataMutex);
+        int cutoff = retainCutoff(*sh);
+        for (auto it = sh->expensePartitions.lower_bound(sh->archiveNext);
+             it != sh->expensePartitions.end() && it->first < cutoff; ++it) {
+            ExpensePartition& part = it->second;
+            if (part.loaded || part.compressed || part.csvOnly) continue;
+
+            // Tried once: a month that cannot be read is not retried every interval
+            sh->archiveNext = part.month + 1;
+            if (!loadPartitionLocked(*sh, part, false)) break;
+            if (!partitionEncodable(part)) {
+                // Nobody has seen the tree yet; the CSV on disk stays as it is
+                part.csvOnly = true;
+                freeTree(part.root);
+                part.root = nullptr;
+                part.loaded = false;
+                break;
+            }
+            part.dirty = true;
+            picked[sh->index] = {&part, part.lastUsed};
+            break;
+        }
+        if (picked[sh->index].first != nullptr) any = true;
+    }
+    if (!any) return;
+
+    for (Shard* sh : shards) {
+        if (picked[sh->index].first != nullptr) markDirty(*sh, false, false, true);
+    }
+    if (!flushDirty()) return;
+
+    for (Shard* sh : shards) {
+        ExpensePartition* part = picked[sh->index].first;
+        if (part == nullptr) continue;
+
+        lock_guard<mutex> lock(sh->dataMutex);
+        if (part->lastUsed != picked[sh->index].second || part->dirty || !part->loaded) continue;
+        freeTree(part->root);
+        part->root = nullptr;
+        part->loaded = false;
+    }
+}
+
+// Background warm-up: load a shard's months newest first, one per lock, up to the limit
+void warmUpWorker(Shard& sh) {
+    int next = 999999;
+    while (!warmUpStop) {
+        lock_guard<mutex> lock(sh.dataMutex);
+
+        int loadedCount = 0;
+        for (const auto& entry : sh.expensePartitions) {
+            if (entry.second.loaded) loadedCount++;
+        }
+        if (loadedCount >= maxLoadedMonths) return;
+
+        auto it = sh.expensePartitions.lower_bound(next);
+        if (it == sh.expensePartitions.begin()) return;
+        --it;
+        next = it->first;
+        loadPartitionLocked(sh, it->second, false);
+    }
+}
+
+void startWarmUp() {
+    const char* w = getenv("TRACKER_WARMUP");
+    if (w == nullptr || string(w) == "0") return;
+    for (Shard* sh : shards) {
+        warmUpThreads.emplace_back([sh] { warmUpWorker(*sh); });
+    }
+}
+
+void stopWarmUp() {
+    warmUpStop = true;
+    for (thread& t : warmUpThreads) {
+        if (t.joinable()) t.join();
+    }
+}
+
+// --- Load Expenses ---
+// Reads the shard's partition index only; expense files are faulted in on demand
+void loadExpenses(Shard& sh) {
+    ifstream dir(partitionDirectoryFile(sh));
+    string line;
+
+    if (!dir.is_open()) {
+        // First run on the old layout: split expenses.csv into months
+        if (sh.prefix != "") return;
+        ifstream legacy(LEGACY_EXPENSES_FILE);
+        Expense exp;
+        int skipped = 0;
+        int duplicates = 0;
+        while (getline(legacy, line)) {
+            if (!parseExpense(line, exp)) continue;
+            if (!isValidDate(exp.date)) {
+                skipped++;
+                continue;
+            }
+            ExpensePartition& part = partitionFor(sh, monthKey(exp.date));
+            if (!addToPartition(part, std::move(exp))) duplicates++;
+            part.dirty = true;
+        }
+        if (!sh.expensePartitions.empty()) {
+            markDirty(sh, false, false, true);
+            cout << "Imported " << sh.expensePartitions.size() << " months from "
+                 << LEGACY_EXPENSES_FILE << "." << endl;
+        }
+        if (skipped > 0) {
+            cout << "Warning: skipped " << skipped << " rows of " << LEGACY_EXPENSES_FILE
+                 << " without a valid DD-MM-YYYY date (the file is left as is)." << endl;
+        }
+        if (duplicates > 0) {
+            cout << "Warning: skipped " << duplicates << " rows of " << LEGACY_EXPENSES_FILE
+                 << " that repeat an expense ID of the same month (the first one is kept)." << endl;
+        }
+        return;
+    }
+
+    // Format: YYYY-MM, Count, Total, MinExpenseID, MaxExpenseID, UserID:Spend;..., csv|blk,
+    //         Date:Spend;..., Category:Spend;...
+    bool rebuilt = false;
+    while (getline(dir, line)) {
+        if (line.empty()) continue;
+        vector<string> data = split(line, ',');
+        if (data.size() < 5) continue;
+
+        ExpensePartition part = makePartition(parseMonthName(data[0]));
+        part.loaded = false;
+        part.compressed = (data.size() >= 7 && data[6] == "blk");
+        part.count = stoi(data[1]);
+        part.total = stod(data[2]);
+        part.minExpenseID = stoi(data[3]);
+        part.maxExpenseID = stoi(data[4]);
+
+        if (data.size() >= 6) {
+            for (const string& us : split(data[5], ';')) {
+                size_t colon = us.find(':');
+                if (colon == string::npos) continue;
+                part.userSpend[stoi(us.substr(0, colon))] = stod(us.substr(colon + 1));
+            }
+        }
+        if (data.size() >= 9) {
+            readTextSpend(data[7], part.dateSpend);
+            readTextSpend(data[8], part.categorySpend);
+        }
+
+        ExpensePartition& stored = sh.expensePartitions.emplace(part.month, part).first->second;
+
+        // Index written before the per-user, per-date and per-category totals
+        // existed: rebuild them from the file once (only the index is rewritten)
+        if (data.size() < 9 && part.count > 0 && loadPartitionLocked(sh, stored, true)) {
+            freeTree(stored.root);
+            stored.root = nullptr;
+            stored.loaded = false;
+            rebuilt = true;
+        }
+    }
+    dir.close();
+    if (rebuilt) markDirty(sh, false, false, true);
+}
+
+// --- Resharding ---
+// Redistribute everything into 'count' shards. Users go by userID, families
+// (with their member slices) by familyID, expenses by the spender's CURRENT
+// family. Every table of the new layout is marked dirty; files of the old
+// layout are left on disk untouched. Returns false, with nothing changed, if
+// a month could not be read.
+bool reshard(int count) {
+    // Every month must be readable before anything moves, or it would be
+    // missing from the new layout
+    for (Shard* sh : shards) {
+        for (auto& entry : sh->expensePartitions) {
+            if (!loadPartitionLocked(*sh, entry.second, false)) return false;
+        }
+    }
+
+    vector<Shard*> old = shards;
+    shards.clear();
+    for (int i = 0; i < count; i++) shards.push_back(makeShard(i, count));
+
+    // 1. Users first: expenses are routed through them
+    for (Shard* sh : old) {
+        drainTree(sh->rootUsers, [](Individual&& ind) {
+            Shard& to = shardOfUser(ind.userID);
+            to.rootUsers = insert(to.rootUsers, std::move(ind));
+        });
+    }
+
+    // 2. Families, copying each member slice into the new shard's pool
+    for (Shard* sh : old) {
+        const vector<int>& oldPool = sh->memberPool;
+        drainTree(sh->rootFamilies, [&oldPool](Family&& fam) {
+            Shard& to = shardOfFamily(fam.familyID);
+            int newOffset = (int)to.memberPool.size();
+            for (int i = 0; i < fam.memberCount; i++) {
+                to.memberPool.push_back(oldPool[fam.memberOffset + i]);
+            }
+            fam.memberOffset = newOffset;
+            fam.memberCapacity = fam.memberCount;
+            to.rootFamilies = insert(to.rootFamilies, std::move(fam));
+        });
+    }
+
+    // 3. Expenses, month by month
+    for (Shard* sh : old) {
+        for (auto& entry : sh->expensePartitions) {
+            int month = entry.first;
+            drainTree(entry.second.root, [month](Expense&& exp) {
+                Node<Individual>* u = findUser(exp.userID);
+                Shard& to = shardOfFamily((u != nullptr) ? u->data.familyID : 0);
+                // Rows saved before dates were validated stay in their month
+                ExpensePartition& part = partitionFor(to, isValidDate(exp.date) ? monthKey(exp.date) : month);
+                addToPartition(part, std::move(exp));
+                part.dirty = true;
+            });
         }
+        delete sh;
     }
-    file.close();
-    cout << "Families loaded." << endl;
+
+    for (Shard* sh : shards) markDirty(*sh, true, true, true);
+    lock_guard<mutex> lock(persistMutex);
+    layoutDirty = true;
+    return true;
 }
 
+// --- Load Everything ---
+// Shards load in parallel; a different TRACKER_SHARDS than on disk reshards once
+void loadAllData() {
+    if (const char* n = getenv("TRACKER_RETAIN_MONTHS")) retainMonths = max(1, atoi(n));
+    if (const char* n = getenv("TRACKER_MAX_LOADED_MONTHS")) maxLoadedMonths = max(1, atoi(n));
 
-// 5. SAVE DATA UTILITIES
+    int stored = 1;
+    ifstream layout(SHARD_LAYOUT_FILE);
+    string line;
+    if (getline(layout, line) && !line.empty()) stored = max(1, stoi(line));
+    layout.close();
 
-// Save Users Recursively
-void saveUserNode(Node<Individual>* root, ofstream& file) {
-    if (root == nullptr) return;
-    
-    // 1. Go Left
-    saveUserNode(root->left, file);
-    
-    // 2. Write Data
-    file << root->data.userID << ","
-         << root->data.name << ","
-         << root->data.income << ","
-         << root->data.familyID << "\n";
-         
-    // 3. Go Right
-    saveUserNode(root->right, file);
-}
+    int wanted = stored;
+    if (const char* n = getenv("TRACKER_SHARDS")) wanted = max(1, atoi(n));
 
-void saveUsers() {
-    ofstream file("users.csv"); // Opens in truncate mode (overwrites file)
-    if (file.is_open()) {
-        saveUserNode(rootUsers, file);
-        file.close();
-        cout << "Users saved." << endl;
-    } else {
-        cout << "Error opening users.csv for writing!" << endl;
+    for (int i = 0; i < stored; i++) shards.push_back(makeShard(i, stored));
+
+    parallelForShards([](Shard& sh) {
+        loadUsers(sh);
+        loadFamilies(sh);
+        loadExpenses(sh); // Index only, expense files are read on demand
+    });
+    cout << "Users loaded." << endl;
+    cout << "Families loaded." << endl;
+
+    if (wanted != stored) {
+        if (reshard(wanted)) {
+            cout << "Resharded from " << stored << " to " << wanted << " shards." << endl;
+        } else {
+            cout << "Resharding cancelled, keeping " << stored << " shard(s)." << endl;
+        }
     }
-}
 
-// Save Families Recursively 
-void saveFamilyNode(Node<Family>* root, ofstream& file) {
-    if (root == nullptr) return;
-    
-    saveFamilyNode(root->left, file);
-    
-    // Write Data
-    file << root->data.familyID << ","
-         << root->data.familyName << ",";
-         
-    // Join MemberIDs with ';'
-    for (size_t i = 0; i < root->data.memberIDs.size(); i++) {
-        file << root->data.memberIDs[i];
-        if (i != root->data.memberIDs.size() - 1) file << ";";
+    size_t months = 0;
+    for (Shard* sh : shards) {
+        months += sh->expensePartitions.size();
+        for (const auto& entry : sh->expensePartitions) {
+            lastExpenseID = max(lastExpenseID, entry.second.maxExpenseID);
+        }
     }
-    
-    file << "," << root->data.totalIncome << ","
-         << root->data.monthlyExpense << "\n";
-         
-    saveFamilyNode(root->right, file);
+    cout << "Expense index loaded (" << months << " month partitions in "
+         << shards.size() << " shard(s))." << endl;
 }
 
-void saveFamilies() {
-    ofstream file("families.csv");
-    if (file.is_open()) {
-        saveFamilyNode(rootFamilies, file);
-        file.close();
-        cout << "Families saved." << endl;
-    } else {
-        cout << "Error opening families.csv for writing!" << endl;
-    }
+// Budget comparison shared by addExpense(), getTotalExpense() and the anomaly report
+bool isOverBudget(const Family& fam, double spend) {
+    return spend > fam.totalIncome;
 }
 
-// Save Expenses Recursively 
-void saveExpenseNode(Node<Expense>* root, ofstream& file) {
+// --- Family Membership (incremental) ---
+// Every change to a user's family or income adjusts the affected family's
+// member slice, memberCount and totalIncome directly, so the budget check never
+// needs a full recomputation. Callers hold AllShardsLock.
+
+// Rebuild the pool with tight slices once too much of it is abandoned
+void compactFamilyNode(Node<Family>* root, const vector<int>& oldPool, vector<int>& pool) {
     if (root == nullptr) return;
-    
-    saveExpenseNode(root->left, file);
-    
-    // Write Data
-    file << root->data.expenseID << ","
-         << root->data.userID << ","
-         << root->data.category << ","
-         << root->data.amount << ","
-         << root->data.date << "\n";
-         
-    saveExpenseNode(root->right, file);
+    compactFamilyNode(root->left, oldPool, pool);
+
+    Family& fam = root->data;
+    int newOffset = (int)pool.size();
+    for (int i = 0; i < fam.memberCount; i++) {
+        pool.push_back(oldPool[fam.memberOffset + i]);
+    }
+    fam.memberOffset = newOffset;
+    fam.memberCapacity = fam.memberCount;
+
+    compactFamilyNode(root->right, oldPool, pool);
 }
 
-void saveExpenses() {
-    ofstream file("expenses.csv");
-    if (file.is_open()) {
-        saveExpenseNode(rootExpenses, file);
-        file.close();
-        cout << "Expenses saved." << endl;
-    } else {
-        cout << "Error opening expenses.csv for writing!" << endl;
+void compactMemberPool(Shard& sh) {
+    vector<int> pool;
+    pool.reserve(sh.memberPool.size() - sh.memberPoolWaste);
+    compactFamilyNode(sh.rootFamilies, sh.memberPool, pool);
+    sh.memberPool.swap(pool);
+    sh.memberPoolWaste = 0;
+}
+
+void addFamilyMember(Shard& sh, Family& fam, int userID) {
+    vector<int>& memberPool = sh.memberPool;
+
+    // Slice full: move it to the end of the pool with double the room
+    if (fam.memberCount == fam.memberCapacity) {
+        int newCapacity = max(2, fam.memberCapacity * 2);
+        int newOffset = (int)memberPool.size();
+        memberPool.resize(memberPool.size() + newCapacity, 0);
+        for (int i = 0; i < fam.memberCount; i++) {
+            memberPool[newOffset + i] = memberPool[fam.memberOffset + i];
+        }
+        sh.memberPoolWaste += fam.memberCapacity;
+        fam.memberOffset = newOffset;
+        fam.memberCapacity = newCapacity;
     }
+    memberPool[fam.memberOffset + fam.memberCount] = userID;
+    fam.memberCount++;
 }
 
-// Master Save Function 
-void saveAllData() {
-    saveUsers();
-    saveFamilies();
-    saveExpenses();
+// Returns false if the user was not listed in the family
+bool removeFamilyMember(Shard& sh, Family& fam, int userID) {
+    vector<int>& memberPool = sh.memberPool;
+    for (int i = 0; i < fam.memberCount; i++) {
+        if (memberPool[fam.memberOffset + i] == userID) {
+            // Shift the rest down to keep member order
+            for (int j = i + 1; j < fam.memberCount; j++) {
+                memberPool[fam.memberOffset + j - 1] = memberPool[fam.memberOffset + j];
+            }
+            fam.memberCount--;
+            return true;
+        }
+    }
+    return false;
 }
 
-// 6. CORE LOGIC & HELPERS
+// Move a user into another family (0 = no family), keeping both totals right
+void setUserFamily(Node<Individual>* uNode, int newFamilyID) {
+    Individual& user = uNode->data;
 
-// Find Maximum ID in Tree (Right-most node)
-template <typename T>
-int getMaxID(Node<T>* root) {
-    if (root == nullptr) return 0;
-    while (root->right != nullptr) {
-        root = root->right;
+    // Only take back income the family actually counted
+    Node<Family>* oldFam = findFamily(user.familyID);
+    if (oldFam != nullptr &&
+        removeFamilyMember(shardOfFamily(user.familyID), oldFam->data, user.userID)) {
+        oldFam->data.totalIncome -= user.income;
+    }
+
+    user.familyID = newFamilyID;
+
+    Node<Family>* newFam = findFamily(newFamilyID);
+    if (newFam != nullptr) {
+        Shard& sh = shardOfFamily(newFamilyID);
+        addFamilyMember(sh, newFam->data, user.userID);
+        newFam->data.totalIncome += user.income;
+
+        if (sh.memberPoolWaste > 64 && sh.memberPoolWaste * 2 > (int)sh.memberPool.size()) {
+            compactMemberPool(sh);
+        }
     }
-    return 0;
 }
 
-// Specializations for Max ID
-int getMaxUserID(Node<Individual>* root) {
-    if (root == nullptr) return 0;
-    while (root->right != nullptr) root = root->right;
-    return root->data.userID;
+// --- Membership Repair ---
+// The users' familyIDs are the source of truth. Files written by older
+// versions can have member lists (and so totalIncome) in families.csv that
+// disagree with them, so every family's slice and income is rebuilt once after
+// loading: listed members that really belong keep their order, members missing
+// from the list are appended in user ID order.
+
+void collectFamilyClaims(Node<Individual>* root, unordered_map<int, vector<int>>& claims) {
+    if (root == nullptr) return;
+    collectFamilyClaims(root->left, claims);
+    if (root->data.familyID != 0) claims[root->data.familyID].push_back(root->data.userID);
+    collectFamilyClaims(root->right, claims);
 }
 
-int getMaxFamilyID(Node<Family>* root) {
-    if (root == nullptr) return 0;
-    while (root->right != nullptr) root = root->right;
-    return root->data.familyID;
+// Appends uid to the family's new slice [start, end) unless it is already there
+void appendMember(vector<int>& pool, int start, int uid, double& income) {
+    if (find(pool.begin() + start, pool.end(), uid) != pool.end()) return;
+    pool.push_back(uid);
+    income += findUser(uid)->data.income;
 }
 
-int getMaxExpenseID(Node<Expense>* root) {
+int repairFamilyNode(Node<Family>* root, const vector<int>& oldPool, vector<int>& pool,
+                     const unordered_map<int, vector<int>>& claims) {
     if (root == nullptr) return 0;
-    while (root->right != nullptr) root = root->right;
-    return root->data.expenseID;
-}
+    int repaired = repairFamilyNode(root->left, oldPool, pool, claims);
 
-// Search Function 
-// Returns pointer to Node if found, nullptr otherwise
-template <typename T>
-Node<T>* search(Node<T>* root, int id) {
-    if (root == nullptr) return nullptr;
-    
-    // Create a dummy object with just the ID to compare
-    T dummy;
-    return nullptr; 
+    Family& fam = root->data;
+    int newOffset = (int)pool.size();
+    double income = 0;
+
+    for (int i = 0; i < fam.memberCount; i++) {
+        Node<Individual>* u = findUser(oldPool[fam.memberOffset + i]);
+        if (u != nullptr && u->data.familyID == fam.familyID) {
+            appendMember(pool, newOffset, u->data.userID, income);
+        }
+    }
+    int kept = (int)pool.size() - newOffset;
+
+    auto it = claims.find(fam.familyID);
+    if (it != claims.end()) {
+        for (int uid : it->second) appendMember(pool, newOffset, uid, income);
+    }
+    int newCount = (int)pool.size() - newOffset;
+
+    // Income is compared loosely: the CSV keeps only 6 significant digits
+    bool incomeOff = fabs(income - fam.totalIncome) > 0.01 + 1e-5 * fabs(income);
+    if (kept != fam.memberCount || newCount != fam.memberCount || incomeOff) repaired++;
+
+    fam.memberOffset = newOffset;
+    fam.memberCount = newCount;
+    fam.memberCapacity = newCount;
+    fam.totalIncome = income;
+
+    return repaired + repairFamilyNode(root->right, oldPool, pool, claims);
 }
 
-Node<Individual>* searchUser(Node<Individual>* root, int id) {
-    if (root == nullptr || root->data.userID == id) return root;
-    if (id < root->data.userID) return searchUser(root->left, id);
-    return searchUser(root->right, id);
+// Called once after loading, before any background thread starts
+void repairFamilyMembership() {
+    unordered_map<int, vector<int>> claims;
+    for (Shard* sh : shards) collectFamilyClaims(sh->rootUsers, claims);
+
+    int repaired = 0;
+    for (Shard* sh : shards) {
+        vector<int> pool;
+        pool.reserve(sh->memberPool.size());
+        int count = repairFamilyNode(sh->rootFamilies, sh->memberPool, pool, claims);
+        sh->memberPool.swap(pool);
+        sh->memberPoolWaste = 0;
+
+        if (count > 0) markDirty(*sh, false, true, false);
+        repaired += count;
+    }
+    if (repaired > 0) {
+        cout << "Repaired members/income of " << repaired
+             << " families to match the users' family IDs." << endl;
+    }
 }
 
-Node<Family>* searchFamily(Node<Family>* root, int id) {
-    if (root == nullptr || root->data.familyID == id) return root;
-    if (id < root->data.familyID) return searchFamily(root->left, id);
-    return searchFamily(root->right, id);
+// Change a user's income and apply the difference to their family
+void setUserIncome(Node<Individual>* uNode, double newIncome) {
+    Node<Family>* fam = findFamily(uNode->data.familyID);
+    if (fam != nullptr) {
+        fam->data.totalIncome += newIncome - uNode->data.income;
+    }
+    uNode->data.income = newIncome;
 }
 
 
@@ -444,7 +2113,7 @@ void addUser() {
     Individual newUser;
     
     // Auto-increment ID
-    newUser.userID = getMaxUserID(rootUsers) + 1;
+    newUser.userID = nextUserID();
     
     cout << "Enter Name: ";
     cin.ignore(); 
@@ -454,13 +2123,30 @@ void addUser() {
     cin >> newUser.income;
     
     cout << "Enter Family ID (0 if new family needed later): ";
-    cin >> newUser.familyID;
+    int famID;
+    cin >> famID;
     
-    // Insert and Save
-    rootUsers = insert(rootUsers, newUser);
-    saveUsers(); 
+    // Insert, join the family (updates its members and income) and queue for saving
+    int newID = newUser.userID;
+    Shard& userShard = shardOfUser(newID);
+    bool joined = false;
+    {
+        AllShardsLock lock;
+        newUser.familyID = 0;
+        userShard.rootUsers = insert(userShard.rootUsers, std::move(newUser));
+        if (famID != 0) {
+            setUserFamily(findUser(newID), famID);
+            joined = (findFamily(famID) != nullptr);
+        }
+    }
+    markDirty(userShard, true, false, false);
+    if (joined) markDirty(shardOfFamily(famID), false, true, false);
+
+    if (famID != 0 && !joined) {
+        cout << "Note: Family " << famID << " does not exist yet." << endl;
+    }
     
-    cout << "User Added Successfully! New User ID: " << newUser.userID << endl;
+    cout << "User Added Successfully! New User ID: " << newID << endl;
 }
 
 // 2. Create Family
@@ -468,7 +2154,7 @@ void createFamily() {
     cout << "\n--- Create New Family ---" << endl;
     Family newFam;
     
-    newFam.familyID = getMaxFamilyID(rootFamilies) + 1;
+    newFam.familyID = nextFamilyID();
     
     cout << "Enter Family Name: ";
     cin.ignore();
@@ -476,6 +2162,9 @@ void createFamily() {
     
     newFam.totalIncome = 0;
     newFam.monthlyExpense = 0;
+    newFam.memberOffset = 0;
+    newFam.memberCount = 0;
+    newFam.memberCapacity = 0;
     
     cout << "How many members (1-4)? ";
     int count;
@@ -486,44 +2175,53 @@ void createFamily() {
         return;
     }
     
+    vector<Node<Individual>*> members;
     for (int i = 0; i < count; i++) {
         int uid;
         cout << "Enter User ID for member " << (i+1) << ": ";
         cin >> uid;
         
         // Validate User exists
-        Node<Individual>* uNode = searchUser(rootUsers, uid);
+        Node<Individual>* uNode = findUser(uid);
         if (uNode != nullptr) {
-            newFam.memberIDs.push_back(uid);
-            // Update User's family ID link
-            uNode->data.familyID = newFam.familyID;
-            // Add to family totals
-            newFam.totalIncome += uNode->data.income;
+            members.push_back(uNode);
         } else {
             cout << "User ID " << uid << " not found! Skipping." << endl;
         }
     }
     
-    // Insert and Save
-    rootFamilies = insert(rootFamilies, newFam);
-    saveFamilies(); // Save new family
-    saveUsers();    // Save users (because we updated their familyID)
+    // Insert, move members in (leaving their old families), queue for saving
+    int newID = newFam.familyID;
+    Shard& famShard = shardOfFamily(newID);
+    {
+        AllShardsLock lock;
+        famShard.rootFamilies = insert(famShard.rootFamilies, std::move(newFam));
+        for (Node<Individual>* uNode : members) {
+            int oldFamID = uNode->data.familyID;
+            setUserFamily(uNode, newID);
+            markDirty(shardOfFamily(oldFamID), false, true, false);
+            markDirty(shardOfUser(uNode->data.userID), true, false, false);
+        }
+    }
+    // Families and users (because we updated their familyID) are saved together
+    markDirty(famShard, false, true, false);
     
-    cout << "Family Created Successfully! Family ID: " << newFam.familyID << endl;
+    cout << "Family Created Successfully! Family ID: " << newID << endl;
 }
 
 // 3. Add Expense
+// Dispatched to the shard that owns the spender's family
 void addExpense() {
     cout << "\n--- Add New Expense ---" << endl;
     Expense newExp;
     
-    newExp.expenseID = getMaxExpenseID(rootExpenses) + 1;
+    newExp.expenseID = lastExpenseID + 1;
     
     cout << "Enter User ID who spent: ";
     cin >> newExp.userID;
     
     // Validate User
-    Node<Individual>* uNode = searchUser(rootUsers, newExp.userID);
+    Node<Individual>* uNode = findUser(newExp.userID);
     if (uNode == nullptr) {
         cout << "User not found! Aborting." << endl;
         return;
@@ -537,29 +2235,87 @@ void addExpense() {
     
     cout << "Enter Date (DD-MM-YYYY): ";
     cin >> newExp.date;
+
+    if (!isValidDate(newExp.date)) {
+        cout << "Invalid date! Use DD-MM-YYYY. Aborting." << endl;
+        return;
+    }
     
-    // Update Family Expense Totals
+    // The month must be in memory before we add to it
     int famID = uNode->data.familyID;
-    Node<Family>* fNode = searchFamily(rootFamilies, famID);
-    if (fNode != nullptr) {
-        fNode->data.monthlyExpense += newExp.amount;
-        if (fNode->data.monthlyExpense > fNode->data.totalIncome) {
-            cout << "WARNING: Family expenses have exceeded total income!" << endl;
-        }
+    Shard& sh = shardOfFamily(famID);
+    ExpensePartition& part = partitionFor(sh, monthKey(newExp.date));
+    if (!ensureLoaded(sh, part)) {
+        cout << "Expenses for " << monthName(part.month) << " could not be read! Aborting." << endl;
+        return;
+    }
+
+    Node<Family>* fNode = findFamily(famID);
+    {
+        lock_guard<mutex> lock(sh.dataMutex);
+
+        // Update Family Expense Totals
+        if (fNode != nullptr) fNode->data.monthlyExpense += newExp.amount;
+
+        // Move into the month's partition
+        lastExpenseID = newExp.expenseID;
+        addToPartition(part, std::move(newExp));
+        part.dirty = true;
+    }
+    // Expense and updated family totals are committed together in the background
+    markDirty(sh, false, true, true);
+
+    // Budget is checked per month
+    if (fNode != nullptr && isOverBudget(fNode->data, familyMonthSpend(famID, part.month))) {
+        cout << "WARNING: Family expenses for " << monthName(part.month)
+             << " have exceeded total income!" << endl;
     }
     
-    // Insert and Save
-    rootExpenses = insert(rootExpenses, newExp);
-    saveExpenses();
-    saveFamilies(); // Save updated totals
-    
-    cout << "Expense Added Successfully! ID: " << newExp.expenseID << endl;
+    cout << "Expense Added Successfully! ID: " << lastExpenseID << endl;
+}
+
+// 4. Update User (income and/or family)
+void updateUser() {
+    cout << "\n--- Update User ---" << endl;
+    int uid;
+    cout << "Enter User ID: ";
+    cin >> uid;
+
+    Node<Individual>* uNode = findUser(uid);
+    if (uNode == nullptr) {
+        cout << "User not found! Aborting." << endl;
+        return;
+    }
+
+    double income;
+    int famID;
+    cout << "Current Income: " << uNode->data.income << ". Enter New Income: ";
+    cin >> income;
+    cout << "Current Family ID: " << uNode->data.familyID << ". Enter New Family ID (0 for none): ";
+    cin >> famID;
+
+    if (famID != 0 && findFamily(famID) == nullptr) {
+        cout << "Family not found! Aborting." << endl;
+        return;
+    }
+
+    int oldFamID = uNode->data.familyID;
+    {
+        AllShardsLock lock;
+        setUserIncome(uNode, income);
+        if (famID != uNode->data.familyID) setUserFamily(uNode, famID);
+    }
+    markDirty(shardOfUser(uid), true, false, false);
+    markDirty(shardOfFamily(oldFamID), false, true, false);
+    markDirty(shardOfFamily(famID), false, true, false);
+
+    cout << "User Updated Successfully!" << endl;
 }
 
 // 8. ANALYTICS & REPORTING
 // Date Comparison
 // Returns -1 if d1 < d2, 0 if equal, 1 if d1 > d2
-int compareDates(string d1, string d2) {
+int compareDates(const string& d1, const string& d2) {
     // Format: DD-MM-YYYY
     if (d1 == d2) return 0;
     
@@ -579,7 +2335,7 @@ int compareDates(string d1, string d2) {
 
 // Check if User belongs to Family 
 bool isUserInFamily(int userID, int familyID) {
-    Node<Individual>* u = searchUser(rootUsers, userID);
+    Node<Individual>* u = findUser(userID);
     if (u != nullptr && u->data.familyID == familyID) return true;
     return false;
 }
@@ -587,31 +2343,49 @@ bool isUserInFamily(int userID, int familyID) {
 // 4. Get Total Family Expenses
 void getTotalExpense() {
     int famID;
+    string monthInput;
     cout << "\nEnter Family ID to check: ";
     cin >> famID;
+    cout << "Enter Month (MM-YYYY, 0 for all time): ";
+    cin >> monthInput;
     
-    Node<Family>* fNode = searchFamily(rootFamilies, famID);
+    if (monthInput != "0" && !isValidMonthInput(monthInput)) {
+        cout << "Invalid month! Use MM-YYYY." << endl;
+        return;
+    }
+
+    Node<Family>* fNode = findFamily(famID);
     if (fNode == nullptr) {
         cout << "Family not found!" << endl;
         return;
     }
+
+    // A single month is answered from the partition index, no expense file is read
+    double spend = fNode->data.monthlyExpense;
+    string period = "all time";
+    if (monthInput != "0") {
+        int month = monthKey("01-" + monthInput);
+        period = monthName(month);
+        spend = familyMonthSpend(famID, month);
+    }
     
-    cout << "\n--- Family Status: " << fNode->data.familyName << " ---" << endl;
+    cout << "\n--- Family Status: " << fNode->data.familyName << " (" << period << ") ---" << endl;
     cout << "Total Income: " << fNode->data.totalIncome << endl;
-    cout << "Total Expense: " << fNode->data.monthlyExpense << endl;
+    cout << "Total Expense: " << spend << endl;
     
-    if (fNode->data.monthlyExpense <= fNode->data.totalIncome) {
+    if (!isOverBudget(fNode->data, spend)) {
         cout << "Status: Within Budget (Savings: " 
-             << (fNode->data.totalIncome - fNode->data.monthlyExpense) << ")" << endl;
+             << (fNode->data.totalIncome - spend) << ")" << endl;
     } else {
         cout << "Status: OVER BUDGET! (Deficit: " 
-             << (fNode->data.monthlyExpense - fNode->data.totalIncome) << ")" << endl;
+             << (spend - fNode->data.totalIncome) << ")" << endl;
     }
 }
 
 // Traverse and Accumulate Category Expenses 
+// Aggregated by user ID; names are looked up only when printing
 struct UserExpense {
-    string userName;
+    int userID;
     double amount;
     
     // For sorting
@@ -620,7 +2394,7 @@ struct UserExpense {
     }
 };
 
-void collectCategoryExpenses(Node<Expense>* root, int familyID, string category, 
+void collectCategoryExpenses(Node<Expense>* root, int familyID, const string& category, 
                              vector<UserExpense>& results, double& totalCatExpense) {
     if (root == nullptr) return;
     
@@ -631,21 +2405,17 @@ void collectCategoryExpenses(Node<Expense>* root, int familyID, string category,
         if (isUserInFamily(root->data.userID, familyID)) {
             totalCatExpense += root->data.amount;
             
-            // Find User Name
-            Node<Individual>* u = searchUser(rootUsers, root->data.userID);
-            string uName = (u != nullptr) ? u->data.name : "Unknown";
-            
             // Add to results (combine if user already in list)
             bool found = false;
             for (auto& ue : results) {
-                if (ue.userName == uName) {
+                if (ue.userID == root->data.userID) {
                     ue.amount += root->data.amount;
                     found = true;
                     break;
                 }
             }
             if (!found) {
-                results.push_back({uName, root->data.amount});
+                results.push_back({root->data.userID, root->data.amount});
             }
         }
     }
@@ -662,10 +2432,28 @@ void getCategoricalExpense() {
     cout << "Enter Category (Rent/Utility/Grocery/Stationary/Leisure): ";
     cin >> cat;
     
+    // Every shard collects its share in parallel
+    vector<vector<UserExpense>> perShard(shards.size());
+    vector<double> shardTotals(shards.size(), 0);
+    parallelForShards([&](Shard& sh) {
+        for (ExpensePartition* part : partitionsForFamily(sh, famID)) {
+            collectCategoryExpenses(part->root, famID, cat, perShard[sh.index], shardTotals[sh.index]);
+        }
+    });
+
+    // Merge (a member who moved in can have rows in several shards)
     vector<UserExpense> results;
     double total = 0;
-    
-    collectCategoryExpenses(rootExpenses, famID, cat, results, total);
+    for (Shard* sh : shards) {
+        total += shardTotals[sh->index];
+        for (const UserExpense& ue : perShard[sh->index]) {
+            auto it = find_if(results.begin(), results.end(), [&ue](const UserExpense& r) {
+                return r.userID == ue.userID;
+            });
+            if (it != results.end()) it->amount += ue.amount;
+            else results.push_back(ue);
+        }
+    }
     
     sort(results.begin(), results.end()); // Sort descending
     
@@ -673,7 +2461,8 @@ void getCategoricalExpense() {
     cout << "Total Family Spend: " << total << endl;
     cout << "Individual Contributions:" << endl;
     for (const auto& r : results) {
-        cout << " - " << r.userName << ": " << r.amount << endl;
+        Node<Individual>* u = findUser(r.userID);
+        cout << " - " << ((u != nullptr) ? u->data.name : "Unknown") << ": " << r.amount << endl;
     }
 }
 
@@ -718,7 +2507,9 @@ void getIndividualExpense() {
     vector<CatExpense> results;
     double total = 0;
     
-    collectUserExpenses(rootExpenses, uid, results, total);
+    for (ExpensePartition* part : partitionsForUser(uid)) {
+        collectUserExpenses(part->root, uid, results, total);
+    }
     sort(results.begin(), results.end());
     
     cout << "\n--- Expenses for User " << uid << " ---" << endl;
@@ -730,20 +2521,20 @@ void getIndividualExpense() {
 }
 
 // 7. Get Expenses in Date Range 
-void printRangeExpenses(Node<Expense>* root, string d1, string d2) {
-    if (root == nullptr) return;
-    
-    printRangeExpenses(root->left, d1, d2);
-    
-    // Check range
-    if (compareDates(root->data.date, d1) >= 0 && compareDates(root->data.date, d2) <= 0) {
-        cout << "ID: " << root->data.expenseID 
-             << " | Cat: " << root->data.category 
-             << " | Amt: " << root->data.amount 
-             << " | Date: " << root->data.date << endl;
-    }
-    
-    printRangeExpenses(root->right, d1, d2);
+// Cold blocks outside the days of the range are skipped unread
+void collectRangeExpenses(Shard& sh, ExpensePartition& part, const string& d1, const string& d2,
+                          vector<Expense>& found) {
+    BlockFilter filter;
+    filter.minDay = (part.month == monthKey(d1)) ? dayOf(d1) : 1;
+    filter.maxDay = (part.month == monthKey(d2)) ? dayOf(d2) : 31;
+    filter.users = nullptr;
+
+    scanPartition(sh, part, filter, [&](const Expense& e) {
+        // Check range
+        if (compareDates(e.date, d1) >= 0 && compareDates(e.date, d2) <= 0) {
+            found.push_back(e);
+        }
+    });
 }
 
 void getExpensesInPeriod() {
@@ -752,34 +2543,100 @@ void getExpensesInPeriod() {
     cin >> d1;
     cout << "Enter End Date (DD-MM-YYYY): ";
     cin >> d2;
+
+    if (!isValidDate(d1) || !isValidDate(d2)) {
+        cout << "Invalid date! Use DD-MM-YYYY." << endl;
+        return;
+    }
     
+    // Every shard scans its own overlapping months in parallel
+    vector<vector<Expense>> perShard(shards.size());
+    parallelForShards([&](Shard& sh) {
+        auto it = sh.expensePartitions.lower_bound(monthKey(d1));
+        for (; it != sh.expensePartitions.end() && it->first <= monthKey(d2); ++it) {
+            collectRangeExpenses(sh, it->second, d1, d2, perShard[sh.index]);
+        }
+    });
+
+    // Merge: month first, then ID (same order as a single shard)
+    vector<Expense> found;
+    for (auto& v : perShard) {
+        for (Expense& e : v) found.push_back(std::move(e));
+    }
+    sort(found.begin(), found.end(), [](const Expense& a, const Expense& b) {
+        int ma = monthKey(a.date), mb = monthKey(b.date);
+        if (ma != mb) return ma < mb;
+        return a.expenseID < b.expenseID;
+    });
+
     cout << "\n--- Expenses from " << d1 << " to " << d2 << " ---" << endl;
-    printRangeExpenses(rootExpenses, d1, d2);
+    for (const Expense& e : found) {
+        cout << "ID: " << e.expenseID
+             << " | Cat: " << e.category
+             << " | Amt: " << e.amount
+             << " | Date: " << e.date << endl;
+    }
 }
 
-// 8. Highest Expense Day 
-struct DateSum {
-    string date;
-    double amount;
+// --- Top-K over streaming aggregates ---
+// Totals are accumulated per key in a hash map while walking the trees, then
+// only the k largest are kept in a min-heap: O(n log k) instead of sorting all n.
+// Equal totals are ranked by key (keyLess first), so hash order never shows.
+template <typename K, typename KeyLess = less<K>>
+vector<pair<K, double>> topK(const unordered_map<K, double>& totals, size_t k,
+                             KeyLess keyLess = KeyLess()) {
+    vector<pair<K, double>> result;
+    if (k == 0) return result;
+
+    // a ranks above b
+    auto better = [keyLess](const pair<K, double>& a, const pair<K, double>& b) {
+        if (a.second != b.second) return a.second > b.second;
+        return keyLess(a.first, b.first);
+    };
+    // Lowest ranked on top
+    priority_queue<pair<K, double>, vector<pair<K, double>>, decltype(better)> heap(better);
+
+    for (const auto& t : totals) {
+        if (heap.size() < k) {
+            heap.push(t);
+        } else if (better(t, heap.top())) {
+            heap.pop();
+            heap.push(t);
+        }
+    }
+
+    // Heap pops smallest first, report largest first
+    while (!heap.empty()) {
+        result.push_back(heap.top());
+        heap.pop();
+    }
+    reverse(result.begin(), result.end());
+    return result;
+}
+
+// Orders DD-MM-YYYY keys by date (for tie-breaks in topK)
+struct EarlierDate {
+    bool operator()(const string& a, const string& b) const {
+        return compareDates(a, b) < 0;
+    }
 };
 
-void collectDailyExpenses(Node<Expense>* root, vector<DateSum>& daily, int familyID) {
-    if (root == nullptr) return;
-    collectDailyExpenses(root->left, daily, familyID);
-    
-    if (isUserInFamily(root->data.userID, familyID)) {
-        bool found = false;
-        for (auto& d : daily) {
-            if (d.date == root->data.date) {
-                d.amount += root->data.amount;
-                found = true;
-                break;
-            }
+// Add one shard's partial totals into the overall ones
+template <typename K>
+void mergeTotals(unordered_map<K, double>& into, const unordered_map<K, double>& from) {
+    for (const auto& t : from) into[t.first] += t.second;
+}
+
+// 8. Highest Expense Day 
+// Cold blocks without any of the family's members are skipped unread
+void collectDailyExpenses(Shard& sh, ExpensePartition& part, const vector<int>& members,
+                          unordered_map<string, double>& daily, int familyID) {
+    BlockFilter filter = {1, 31, &members};
+    scanPartition(sh, part, filter, [&](const Expense& e) {
+        if (isUserInFamily(e.userID, familyID)) {
+            daily[e.date] += e.amount;
         }
-        if (!found) daily.push_back({root->data.date, root->data.amount});
-    }
-    
-    collectDailyExpenses(root->right, daily, familyID);
+    });
 }
 
 void getHighestExpenseDay() {
@@ -787,26 +2644,167 @@ void getHighestExpenseDay() {
     cout << "\nEnter Family ID: ";
     cin >> famID;
     
-    vector<DateSum> daily;
-    collectDailyExpenses(rootExpenses, daily, famID);
+    // Every shard totals its share in parallel
+    vector<int> members = familyMembers(famID);
+    vector<unordered_map<string, double>> perShard(shards.size());
+    parallelForShards([&](Shard& sh) {
+        for (ExpensePartition* part : familyPartitions(sh, famID)) {
+            collectDailyExpenses(sh, *part, members, perShard[sh.index], famID);
+        }
+    });
+
+    unordered_map<string, double> daily;
+    for (const auto& partial : perShard) mergeTotals(daily, partial);
     
     if (daily.empty()) {
         cout << "No expenses found for this family." << endl;
         return;
     }
     
-    // Find max
-    string maxDate = "";
-    double maxAmt = -1;
+    // Find max (the earliest date wins a tie)
+    pair<string, double> top = topK(daily, 1, EarlierDate())[0];
     
-    for (const auto& d : daily) {
-        if (d.amount > maxAmt) {
-            maxAmt = d.amount;
-            maxDate = d.date;
+    cout << "\nHighest Expense Day: " << top.first << " (Total: " << top.second << ")" << endl;
+}
+
+// 10. Top Spending Days / Users / Categories (all families)
+// Straight from the partition index: no expense file is read
+// One shard's share of the top spending report
+struct SpendTotals {
+    unordered_map<string, double> daily;
+    unordered_map<string, double> categories;
+    unordered_map<int, double> users;
+};
+
+void getTopSpending() {
+    const size_t K = 10;
+
+    // Every shard aggregates its own expenses in parallel
+    vector<SpendTotals> perShard(shards.size());
+    parallelForShards([&perShard](Shard& sh) {
+        SpendTotals& t = perShard[sh.index];
+
+        for (const auto& entry : sh.expensePartitions) {
+            const ExpensePartition& part = entry.second;
+            mergeTotals(t.users, part.userSpend);
+            mergeTotals(t.daily, part.dateSpend);
+            mergeTotals(t.categories, part.categorySpend);
         }
+    });
+
+    SpendTotals all;
+    for (const SpendTotals& t : perShard) {
+        mergeTotals(all.daily, t.daily);
+        mergeTotals(all.categories, t.categories);
+        mergeTotals(all.users, t.users);
     }
-    
-    cout << "\nHighest Expense Day: " << maxDate << " (Total: " << maxAmt << ")" << endl;
+
+    cout << "\n--- Top " << K << " Spending Days ---" << endl;
+    for (const auto& d : topK(all.daily, K, EarlierDate())) {
+        cout << " - " << d.first << ": " << d.second << endl;
+    }
+
+    cout << "\n--- Top " << K << " Spending Users ---" << endl;
+    for (const auto& u : topK(all.users, K)) {
+        Node<Individual>* uNode = findUser(u.first);
+        cout << " - " << ((uNode != nullptr) ? uNode->data.name : "Unknown")
+             << " (ID " << u.first << "): " << u.second << endl;
+    }
+
+    cout << "\n--- Top " << K << " Spending Categories ---" << endl;
+    for (const auto& c : topK(all.categories, K)) {
+        cout << " - " << c.first << ": " << c.second << endl;
+    }
+}
+
+// 11. Spending Anomalies (all families)
+const int MAX_ANOMALY_WINDOW = 1200; // A century of months keeps the month arithmetic in range
+// FamilyID -> {spend this month, spend over the trailing months}
+struct FamilyTrend {
+    double current;
+    double trailing;
+};
+
+void reportAnomalies(Node<Family>* root, const unordered_map<int, FamilyTrend>& trends,
+                     double factor, int window, vector<pair<int, string>>& flagged) {
+    if (root == nullptr) return;
+    reportAnomalies(root->left, trends, factor, window, flagged);
+
+    auto it = trends.find(root->data.familyID);
+    if (it != trends.end()) {
+        double average = it->second.trailing / window;
+        bool spike = (average > 0 && it->second.current > factor * average);
+        bool overBudget = isOverBudget(root->data, it->second.current);
+
+        if (spike || overBudget) {
+            ostringstream line;
+            line << " - " << root->data.familyName << " (ID " << root->data.familyID << "): "
+                 << it->second.current << " vs trailing avg " << average;
+            if (spike) line << " [SPIKE x" << (it->second.current / average) << "]";
+            if (overBudget) line << " [OVER BUDGET]";
+            flagged.push_back({root->data.familyID, line.str()});
+        }
+    }
+
+    reportAnomalies(root->right, trends, factor, window, flagged);
+}
+
+void getSpendingAnomalies() {
+    string monthInput;
+    double factor;
+    int window;
+    cout << "\nEnter Month (MM-YYYY): ";
+    cin >> monthInput;
+    if (!isValidMonthInput(monthInput)) {
+        cout << "Invalid month! Use MM-YYYY." << endl;
+        return;
+    }
+    cout << "Flag families spending more than N x their trailing average. Enter N: ";
+    cin >> factor;
+    cout << "Trailing months to average: ";
+    cin >> window;
+    if (window < 1) window = 1;
+    if (window > MAX_ANOMALY_WINDOW) {
+        cout << "Invalid window! Use 1 to " << MAX_ANOMALY_WINDOW << " months." << endl;
+        return;
+    }
+
+    // One pass over the index of the months involved (every shard in parallel),
+    // walking only the months that exist in the window; no expense file is read
+    int target = monthKey("01-" + monthInput);
+    int first = monthFromIndex(monthIndex(target) - window);
+    vector<unordered_map<int, FamilyTrend>> perShard(shards.size());
+    parallelForShards([&](Shard& sh) {
+        unordered_map<int, FamilyTrend>& trends = perShard[sh.index];
+        auto end = sh.expensePartitions.upper_bound(target);
+        for (auto part = sh.expensePartitions.lower_bound(first); part != end; ++part) {
+            for (const auto& us : part->second.userSpend) {
+                Node<Individual>* u = findUser(us.first);
+                if (u == nullptr) continue;
+                FamilyTrend& t = trends[u->data.familyID];
+                if (part->first == target) t.current += us.second;
+                else t.trailing += us.second;
+            }
+        }
+    });
+
+    unordered_map<int, FamilyTrend> trends;
+    for (const auto& partial : perShard) {
+        for (const auto& t : partial) {
+            trends[t.first].current += t.second.current;
+            trends[t.first].trailing += t.second.trailing;
+        }
+    }
+
+    vector<pair<int, string>> flagged;
+    for (Shard* sh : shards) {
+        reportAnomalies(sh->rootFamilies, trends, factor, window, flagged);
+    }
+    sort(flagged.begin(), flagged.end());
+
+    cout << "\n--- Spending Anomalies for " << monthName(target) << " ---" << endl;
+    for (const auto& f : flagged) cout << f.second << endl;
+    if (flagged.empty()) cout << "No anomalies found." << endl;
 }
 
 // 9. MAIN MENU
@@ -823,42 +2821,152 @@ void showMenu() {
     cout << "6. Get Individual Expense (Sorted)" << endl;
     cout << "7. Get Expenses in Date Range" << endl;
     cout << "8. Get Highest Expense Day" << endl;
+    cout << "9. Update User (Income / Family)" << endl;
+    cout << "10. Top 10 Spending Days / Users / Categories" << endl;
+    cout << "11. Spending Anomalies (All Families)" << endl;
     cout << "0. Exit" << endl;
     cout << "=========================================" << endl;
     cout << "Enter Choice: ";
 }
 
+// --- Shutdown ---
+// Changes are saved in the background, so every way out of the program goes
+// through here to flush what is still pending: menu exit, end of input,
+// Ctrl+C / SIGTERM, and fatal errors (std::terminate).
+
+mutex shutdownMutex;
+bool shutdownDone = false;
+bool shutdownSaved = false;
+
+// Stop the background threads and flush (only the first call does the work)
+bool shutdownTracker() {
+    lock_guard<mutex> lock(shutdownMutex);
+    if (!shutdownDone) {
+        stopWarmUp();
+        shutdownSaved = stopPersistence();
+        shutdownDone = true;
+    }
+    return shutdownSaved;
+}
+
+void exitOnSignal(int code) {
+    cout << "\nInterrupted. Saving pending changes..." << endl;
+    bool saved = shutdownTracker();
+    cout << (saved ? "Data saved." : "WARNING: last changes could not be saved!") << endl;
+    quick_exit(saved ? code : 1);
+}
+
+#ifdef _WIN32
+BOOL WINAPI consoleHandler(DWORD event) {
+    if (event == CTRL_C_EVENT || event == CTRL_BREAK_EVENT || event == CTRL_CLOSE_EVENT) {
+        exitOnSignal(130);
+    }
+    return FALSE;
+}
+#endif
+
+// SIGINT/SIGTERM are handled on a thread of their own (sigwait), where it is
+// safe to take locks and write files. Called before any other thread starts,
+// so every thread inherits the blocked mask.
+void installSignalHandlers() {
+#ifdef _WIN32
+    SetConsoleCtrlHandler(consoleHandler, TRUE);
+#else
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    thread([signals] {
+        int sig;
+        if (sigwait(&signals, &sig) == 0) exitOnSignal(128 + sig);
+    }).detach();
+#endif
+}
+
+// Last chance after an uncaught exception: flush on a helper thread (the
+// failing thread may hold a lock), wait a few seconds at most, then abort
+void onTerminate() {
+    static atomic<bool> entered(false);
+    if (!entered.exchange(true)) {
+        cout << "\nFatal error! Saving pending changes..." << endl;
+        promise<bool> saved;
+        future<bool> result = saved.get_future();
+        thread([&saved] { saved.set_value(flushDirty()); }).detach();
+        if (result.wait_for(chrono::seconds(5)) != future_status::ready || !result.get()) {
+            cout << "WARNING: last changes could not be saved!" << endl;
+        }
+    } else {
+        // Another thread is already saving and will abort when it is done
+        this_thread::sleep_for(chrono::seconds(10));
+    }
+    abort();
+}
+
 //MAIN FUNCTION
 int main() {
-    // 1. Load Initial Data
-    loadUsers();
-    loadFamilies();
-    loadExpenses();
+    // 1. Finish any save that was interrupted by a crash
+    recoverPendingSave();
+
+    // 2. Load Initial Data (every shard in parallel, expense index only)
+    loadAllData();
+    repairFamilyMembership();
+
+    // 3. Start saving changes (and optionally warming the cache) in the background
+    // and make sure they are flushed however the program ends
+    installSignalHandlers();
+    set_terminate(onTerminate);
+    startPersistence();
+    startWarmUp();
     
     int choice;
     while (true) {
         showMenu();
         if (!(cin >> choice)) {
-            // Handle non-integer input
+            // Input closed (Ctrl+D / piped input): save and leave
+            if (cin.eof()) {
+                choice = 0;
+            } else {
+                // Handle non-integer input
+                cin.clear();
+                cin.ignore(10000, '\n');
+                continue;
+            }
+        }
+
+        try {
+            switch (choice) {
+                case 1: addUser(); break;
+                case 2: createFamily(); break;
+                case 3: addExpense(); break;
+                case 4: getTotalExpense(); break;
+                case 5: getCategoricalExpense(); break;
+                case 6: getIndividualExpense(); break;
+                case 7: getExpensesInPeriod(); break;
+                case 8: getHighestExpenseDay(); break;
+                case 9: updateUser(); break;
+                case 10: getTopSpending(); break;
+                case 11: getSpendingAnomalies(); break;
+                case 0:
+                    if (shutdownTracker()) {
+                        cout << "Exiting... Data saved." << endl;
+                        return 0;
+                    }
+                    cout << "Exiting... WARNING: last changes could not be saved!" << endl;
+                    return 1;
+                default: cout << "Invalid choice!" << endl;
+            }
+
+            // Give back memory of old months the last report pulled in
+            for (Shard* sh : shards) evictColdPartitions(*sh);
+        } catch (const exception& e) {
+            // Abort only this action; what earlier actions changed is saved right away
+            cout << "Error: " << e.what() << ". Action aborted." << endl;
             cin.clear();
             cin.ignore(10000, '\n');
-            continue;
-        }
-        
-        switch (choice) {
-            case 1: addUser(); break;
-            case 2: createFamily(); break;
-            case 3: addExpense(); break;
-            case 4: getTotalExpense(); break;
-            case 5: getCategoricalExpense(); break;
-            case 6: getIndividualExpense(); break;
-            case 7: getExpensesInPeriod(); break;
-            case 8: getHighestExpenseDay(); break;
-            case 0: 
-                cout << "Exiting... Data saved." << endl;
-                return 0;
-            default: cout << "Invalid choice!" << endl;
+            if (!flushDirty()) cout << "WARNING: pending changes could not be saved!" << endl;
         }
     }
     return 0;
-}
\ No newline at end of file
+}